@@ -0,0 +1,404 @@
+/*
+    Benchmark of star: generates synthetic corpora, runs the commands of star on them and writes one line of JSON
+    per command to the standard output, so the results can be kept and compared over time (make bench).
+
+    Use: bench [-d workDir] [-s scale] [-f "star options"] [-k] <path of star>
+        -d  Directory where the corpora and tar files are created. It is removed at the end unless -k is given.
+        -s  Percentage of the size of the corpora (100 by default). 10 gives a quick run.
+        -f  Options added to every command, to compare modes (for example "--uring" or "-j 4").
+
+    Every line has the case, the command, the bytes and files it moved, the wall time, MB/s, files per second (ops/s),
+    the peak resident memory of the command and the amount of read and write system calls it made.
+    The system calls are the syscr and syscw counters of /proc/<pid>/io, read when the command exits (the
+    command is traced only to stop it there). They are -1 if the system does not give them.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+
+#define MAX_ARGUMENTS 64 // Arguments of a command besides the names of the files
+#define PATH_SIZE 4096
+#define CHURN_ROUNDS 10 // Rounds of delete and append that fragment the tar file of the "fragmented" case
+#define CHURN_PERCENT 10 // Files deleted and added again in every round
+#define CHANGE_PERCENT 10 // Files appended (-r), updated (-u) and deleted (-d) by the measured commands
+
+/*
+    Kind of content of the files of a corpus.
+*/
+#define CONTENT_TEXT 0 // Lines of words, compresses well
+#define CONTENT_RANDOM 1 // Incompressible bytes
+
+/*
+    Corpus of one case: numFiles files with sizes between minSize and maxSize.
+*/
+struct Case {
+    const char * name;
+    int numFiles;
+    off_t minSize;
+    off_t maxSize;
+    int content;
+    const char * options; // Options of star used by every command of the case
+    int churn; // 1 if the tar file is fragmented with rounds of delete and append before the commands are measured
+};
+
+/*
+    Measures of one command.
+*/
+struct Result {
+    double seconds;
+    long peakMemory; // Kilobytes
+    long long readCalls; // -1 if not available
+    long long writeCalls;
+    int status; // Exit code of the command
+};
+
+static const struct Case cases[] = {
+    {"tiny", 5000, 64, 2048, CONTENT_TEXT, "", 0},
+    {"huge", 3, 64 << 20, 64 << 20, CONTENT_RANDOM, "", 0},
+    {"text", 100, 1 << 20, 1 << 20, CONTENT_TEXT, "--compress", 0},
+    {"random", 100, 1 << 20, 1 << 20, CONTENT_RANDOM, "--compress", 0},
+    {"fragmented", 2000, 1024, 64 << 10, CONTENT_TEXT, "", 1},
+};
+
+static const char * words[] = {"the", "file", "packager", "stores", "blocks", "of", "content", "in", "one", "archive",
+                               "index", "header", "blank", "space", "is", "reused", "when", "deleted", "files", "leave", "holes"};
+
+static uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+static const char * starPath;
+static const char * extraOptions = "";
+
+/*
+    Function to obtain the next number of a xorshift generator. The corpora are the same in every run.
+*/
+uint64_t nextRandom(void){
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+/*
+    Function to obtain the current time in seconds.
+*/
+double currentSeconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+    Function to write a file of 'size' bytes with the content of the case.
+    Returns -1 on error.
+*/
+int writeCorpusFile(const char * fileName, off_t size, int content){
+    static char buffer[64 * 1024];
+    FILE * file = fopen(fileName, "wb");
+    if (file == NULL) return -1;
+    for (off_t written = 0; written < size;){
+        size_t length = size - written < (off_t)sizeof(buffer) ? (size_t)(size - written) : sizeof(buffer);
+        if (content == CONTENT_RANDOM){
+            for (size_t i = 0; i < length; i += 8){
+                uint64_t value = nextRandom();
+                memcpy(buffer + i, &value, length - i < 8 ? length - i : 8);
+            }
+        }else{
+            for (size_t i = 0; i < length;){
+                const char * word = words[nextRandom() % (sizeof(words) / sizeof(words[0]))];
+                for (; *word != '\0' && i < length; word++) buffer[i++] = *word;
+                if (i < length) buffer[i++] = nextRandom() % 12 == 0 ? '\n' : ' ';
+            }
+        }
+        if (fwrite(buffer, 1, length, file) != length){
+            fclose(file);
+            return -1;
+        }
+        written += length;
+    }
+    return fclose(file);
+}
+
+/*
+    Function to obtain a size of the case, scaled by 'scale' percent. Never 0, star does not store empty files.
+*/
+off_t pickSize(const struct Case * benchCase, int scale){
+    off_t size = benchCase->minSize;
+    if (benchCase->maxSize > benchCase->minSize)
+        size += nextRandom() % (benchCase->maxSize - benchCase->minSize + 1);
+    size = size * scale / 100;
+    return size > 0 ? size : 1;
+}
+
+/*
+    Function to write "directory/name" in path, of PATH_SIZE bytes.
+    Returns -1 if it does not fit.
+*/
+int joinPath(char * path, const char * directory, const char * name){
+    int length = snprintf(path, PATH_SIZE, "%s/%s", directory, name);
+    return length < 0 || length >= PATH_SIZE ? -1 : 0;
+}
+
+/*
+    Function to read the read and write system calls made by process 'pid' from /proc/<pid>/io.
+*/
+void readSystemCalls(pid_t pid, struct Result * result){
+    char path[64], line[128];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE * file = fopen(path, "r");
+    if (file == NULL) return;
+    while (fgets(line, sizeof(line), file) != NULL){
+        sscanf(line, "syscr: %lld", &result->readCalls);
+        sscanf(line, "syscw: %lld", &result->writeCalls);
+    }
+    fclose(file);
+}
+
+/*
+    Function to run star with 'arguments' (ended by NULL) in 'directory', with its output discarded.
+    The command is traced only to stop it when it exits, to read its system calls before it is gone.
+    Returns the measures in 'result'.
+*/
+void runStar(const char * directory, char * arguments[], struct Result * result){
+    result->readCalls = result->writeCalls = -1;
+    result->peakMemory = 0;
+    result->status = -1;
+    double startTime = currentSeconds();
+    pid_t pid = fork();
+    if (pid == 0){
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        if (chdir(directory) == -1) _exit(127);
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL); // If it fails, the command runs without the counters
+        execv(arguments[0], arguments);
+        _exit(127);
+    }
+    if (pid == -1){
+        perror("fork");
+        return;
+    }
+    int status;
+    struct rusage usage;
+    int traced = 0;
+    while (wait4(pid, &status, 0, &usage) == pid){
+        if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+        int signal = 0;
+        if (WSTOPSIG(status) == SIGTRAP && !traced){ // Stopped by execv
+            traced = 1;
+            ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL));
+        }else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))){ // Exiting
+            readSystemCalls(pid, result);
+        }else{
+            signal = WSTOPSIG(status); // Delivered as if it was not traced
+        }
+        ptrace(PTRACE_CONT, pid, NULL, (void *)(intptr_t)signal);
+    }
+    result->seconds = currentSeconds() - startTime;
+    result->peakMemory = usage.ru_maxrss;
+    result->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/*
+    Function to build the arguments of star: its path, the command, the options of the case and of -f, the tar file
+    and 'numFiles' names of 'fileNames'. The options are split by spaces.
+    Returns the arguments, ended by NULL, that are freed with free.
+*/
+char ** buildArguments(const char * command, const char * options, const char * tarFile, int numFiles, char ** fileNames){
+    char ** arguments = (char **)malloc((MAX_ARGUMENTS + numFiles + 1) * sizeof(char *));
+    static char optionWords[2][256];
+    int count = 0;
+    arguments[count++] = (char *)starPath;
+    arguments[count++] = (char *)command;
+    const char * sources[2] = {options, extraOptions};
+    for (int s = 0; s < 2; s++){
+        snprintf(optionWords[s], sizeof(optionWords[s]), "%s", sources[s]);
+        for (char * word = strtok(optionWords[s], " "); word != NULL && count < MAX_ARGUMENTS - 1; word = strtok(NULL, " "))
+            arguments[count++] = word;
+    }
+    arguments[count++] = (char *)tarFile;
+    for (int i = 0; i < numFiles; i++)
+        arguments[count++] = fileNames[i];
+    arguments[count] = NULL;
+    return arguments;
+}
+
+/*
+    Function to print the measures of one command as a line of JSON.
+    bytes and files are the amount moved by the command, used for MB/s and ops/s.
+*/
+void printResult(const struct Case * benchCase, const char * command, long long bytes, int files, const struct Result * result){
+    double seconds = result->seconds > 0 ? result->seconds : 1e-9;
+    printf("{\"timestamp\": %lld, \"case\": \"%s\", \"command\": \"%s\", \"options\": \"%s%s%s\", \"files\": %d, \"bytes\": %lld, "
+           "\"seconds\": %.6f, \"mb_per_s\": %.2f, \"ops_per_s\": %.1f, \"peak_rss_kb\": %ld, "
+           "\"read_syscalls\": %lld, \"write_syscalls\": %lld, \"exit\": %d}\n",
+           (long long)time(NULL), benchCase->name, command, benchCase->options, *benchCase->options && *extraOptions ? " " : "",
+           extraOptions, files, bytes, result->seconds, bytes / seconds / (1024 * 1024), files / seconds, result->peakMemory,
+           result->readCalls, result->writeCalls, result->status);
+    fflush(stdout);
+}
+
+/*
+    Function to run one command of the benchmark, with the names of 'numNames' files, and print its result.
+    files and bytes are the amount the command moves.
+*/
+void measure(const struct Case * benchCase, const char * directory, const char * command, const char * tarFile,
+             int numNames, char ** fileNames, int files, long long bytes){
+    struct Result result;
+    char ** arguments = buildArguments(command, benchCase->options, tarFile, numNames, fileNames);
+    runStar(directory, arguments, &result);
+    free(arguments);
+    printResult(benchCase, command, bytes, files, &result);
+}
+
+/*
+    Function to obtain the size of a file, 0 if it does not exist.
+*/
+long long sizeOfFile(const char * fileName){
+    struct stat info;
+    return stat(fileName, &info) == 0 ? (long long)info.st_size : 0;
+}
+
+/*
+    Function to run every command on the corpus of one case, in workDir/<case>.
+    The corpus is created first; the appended files (-r) are created apart, so they are not in the first tar file.
+    Returns -1 on error.
+*/
+int runCase(const struct Case * benchCase, const char * workDir, int scale){
+    char caseDir[PATH_SIZE], sourceDir[PATH_SIZE], outputDir[PATH_SIZE], tarFile[PATH_SIZE];
+    if (joinPath(caseDir, workDir, benchCase->name) == -1 || joinPath(sourceDir, caseDir, "src") == -1 ||
+        joinPath(outputDir, caseDir, "out") == -1 || joinPath(tarFile, caseDir, "a.tar") == -1){
+        fprintf(stderr, "The path of the work directory is too long.\n");
+        return -1;
+    }
+    if ((mkdir(caseDir, 0777) == -1 && errno != EEXIST) || (mkdir(sourceDir, 0777) == -1 && errno != EEXIST) ||
+        (mkdir(outputDir, 0777) == -1 && errno != EEXIST)){
+        perror(caseDir);
+        return -1;
+    }
+    int numFiles = benchCase->numFiles;
+    int numChanged = numFiles * CHANGE_PERCENT / 100 > 0 ? numFiles * CHANGE_PERCENT / 100 : 1;
+    char ** names = (char **)malloc((numFiles + numChanged) * sizeof(char *)); // The corpus, then the appended files
+    off_t * sizes = (off_t *)malloc((numFiles + numChanged) * sizeof(off_t));
+    if (names == NULL || sizes == NULL) return -1;
+    long long corpusBytes = 0, appendedBytes = 0, updatedBytes = 0, deletedBytes = 0;
+    for (int i = 0; i < numFiles + numChanged; i++){
+        char path[PATH_SIZE];
+        names[i] = (char *)malloc(32);
+        snprintf(names[i], 32, i < numFiles ? "f%d" : "new%d", i);
+        sizes[i] = pickSize(benchCase, scale);
+        if (joinPath(path, sourceDir, names[i]) == -1 || writeCorpusFile(path, sizes[i], benchCase->content) == -1){
+            perror(path);
+            return -1;
+        }
+        if (i < numFiles) corpusBytes += sizes[i];
+        else appendedBytes += sizes[i];
+        if (i < numChanged) updatedBytes += sizes[i];
+        if (i >= numChanged && i < 2 * numChanged) deletedBytes += sizes[i];
+    }
+    char relativeTar[] = "../a.tar"; // From src and out
+
+    measure(benchCase, sourceDir, "-c", relativeTar, numFiles, names, numFiles, corpusBytes);
+    if (benchCase->churn){ // Deletes and appends again random files, with new sizes, so the holes do not fit them
+        int numChurned = numFiles * CHURN_PERCENT / 100 > 0 ? numFiles * CHURN_PERCENT / 100 : 1;
+        char ** churned = (char **)malloc(numChurned * sizeof(char *));
+        struct Result result;
+        for (int round = 0; round < CHURN_ROUNDS; round++){
+            for (int i = 0; i < numChurned; i++){
+                int index = (int)(nextRandom() % numFiles);
+                int repeated = 0;
+                for (int j = 0; j < i; j++) repeated |= churned[j] == names[index];
+                if (repeated){ // Each name once per round
+                    i--;
+                    continue;
+                }
+                churned[i] = names[index];
+            }
+            char ** arguments = buildArguments("-d", benchCase->options, relativeTar, numChurned, churned);
+            runStar(sourceDir, arguments, &result);
+            free(arguments);
+            for (int i = 0; i < numChurned; i++){
+                char path[PATH_SIZE];
+                if (joinPath(path, sourceDir, churned[i]) == -1 || writeCorpusFile(path, pickSize(benchCase, scale), benchCase->content) == -1){
+                    perror(path);
+                    return -1;
+                }
+            }
+            arguments = buildArguments("-r", benchCase->options, relativeTar, numChurned, churned);
+            runStar(sourceDir, arguments, &result);
+            free(arguments);
+        }
+        free(churned);
+        corpusBytes = 0;
+        for (int i = 0; i < numFiles; i++){
+            char path[PATH_SIZE];
+            sizes[i] = joinPath(path, sourceDir, names[i]) == 0 ? sizeOfFile(path) : 0;
+            corpusBytes += sizes[i];
+        }
+        updatedBytes = deletedBytes = 0;
+        for (int i = 0; i < numChanged; i++){
+            updatedBytes += sizes[i];
+            deletedBytes += sizes[numChanged + i];
+        }
+    }
+    measure(benchCase, sourceDir, "-t", relativeTar, 0, NULL, numFiles, 0);
+    measure(benchCase, outputDir, "-x", relativeTar, 0, NULL, numFiles, corpusBytes);
+    measure(benchCase, sourceDir, "-r", relativeTar, numChanged, names + numFiles, numChanged, appendedBytes);
+    measure(benchCase, sourceDir, "-u", relativeTar, numChanged, names, numChanged, updatedBytes);
+    measure(benchCase, sourceDir, "-d", relativeTar, numChanged, names + numChanged, numChanged, deletedBytes);
+    measure(benchCase, sourceDir, "-p", relativeTar, 0, NULL, numFiles + numChanged, sizeOfFile(tarFile));
+    for (int i = 0; i < numFiles + numChanged; i++)
+        free(names[i]);
+    free(names);
+    free(sizes);
+    return 0;
+}
+
+int main(int argc, char * argv[]){
+    const char * workDir = "bench-work";
+    int scale = 100, keep = 0, option;
+    while ((option = getopt(argc, argv, "d:s:f:k")) != -1){
+        if (option == 'd') workDir = optarg;
+        else if (option == 's') scale = atoi(optarg);
+        else if (option == 'f') extraOptions = optarg;
+        else if (option == 'k') keep = 1;
+        else break;
+    }
+    if (optind != argc - 1 || scale <= 0){
+        fprintf(stderr, "Use: %s [-d workDir] [-s scale] [-f \"star options\"] [-k] <path of star>\n", argv[0]);
+        return 1;
+    }
+    char absoluteStar[PATH_SIZE];
+    if (realpath(argv[optind], absoluteStar) == NULL){ // The commands run in other directories
+        perror(argv[optind]);
+        return 1;
+    }
+    starPath = absoluteStar;
+    if (mkdir(workDir, 0777) == -1 && errno != EEXIST){
+        perror(workDir);
+        return 1;
+    }
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]) && !failed; i++){
+        failed = runCase(&cases[i], workDir, scale) == -1;
+        if (!keep){
+            char caseDir[PATH_SIZE], command[PATH_SIZE + 16];
+            joinPath(caseDir, workDir, cases[i].name);
+            snprintf(command, sizeof(command), "rm -rf '%s'", caseDir);
+            if (system(command) != 0) failed = 1;
+        }
+    }
+    if (!keep) rmdir(workDir);
+    return failed;
+}
@@ -0,0 +1,248 @@
+/*
+    Command line program of star. It only uses the library, through star.h.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "star.h"
+
+#define FILE_LIST_CAPACITY 16 // Names reserved at first by readFileList, doubled when it is full
+
+/*
+    Modifiers of the command line that are not options of the handle.
+*/
+struct Modifiers {
+    int stdoutMode; // 1 if the extracted files are written to the standard output. --stdout
+    off_t rangeOffset; // Range of the file to extract. --offset
+    off_t rangeLength; // -1 until the end of the file. --length
+    int statsMode; // 1 if the counters of the handle are printed in JSON when the command ends. --stats
+};
+
+/*
+    Function to read the modifiers of the command ("-j N" and the arguments that start with "--").
+    They are removed from argv so the rest of the arguments keep their positions.
+    Updates argc with the remaining amount of arguments.
+    options gets the ones of the handle, and modifiers the rest.
+*/
+static void parseModifiers(int * argc, char * argv[], struct StarOptions * options, struct Modifiers * modifiers){
+    int remaining = 1;
+    for (int i = 1; i < *argc; i++){
+        if (strcmp(argv[i], "--buffered") == 0){ // Never use kernel transfers
+            options->transferMode = STAR_TRANSFER_BUFFERED;
+        }else if (strcmp(argv[i], "--compress") == 0){ // New files stored in compressed blocks
+            options->compressionLevel = STAR_COMPRESSION_DEFAULT;
+        }else if (strncmp(argv[i], "--compress=", 11) == 0){ // With a level from 1 (fastest) to 9 (smallest)
+            options->compressionLevel = atoi(argv[i] + 11);
+            if (options->compressionLevel < 1 || options->compressionLevel > 9){
+                fprintf(stderr, "The compression level must be from 1 to 9.\n");
+                exit(1);
+            }
+        }else if (strcmp(argv[i], "--dictionary") == 0){ // Compressed, with a dictionary for the small files
+            options->dictionaryMode = 1;
+            if (options->compressionLevel == 0) options->compressionLevel = STAR_COMPRESSION_DEFAULT;
+        }else if (strcmp(argv[i], "--dedup") == 0){ // New files stored as chunks shared with the rest of files
+            options->dedupMode = 1;
+        }else if (strcmp(argv[i], "--mmap") == 0){ // Read the index and the files from a mapping of the tar file
+            options->readMode = STAR_READ_MMAP;
+        }else if ((strcmp(argv[i], "--offset") == 0 || strcmp(argv[i], "--length") == 0) && i + 1 < *argc){ // Range of a file to extract
+            char * end;
+            long long value = strtoll(argv[i + 1], &end, 10);
+            if (*argv[i + 1] == '\0' || *end != '\0' || value < 0){
+                fprintf(stderr, "%s must be a number of bytes.\n", argv[i]);
+                exit(1);
+            }
+            if (strcmp(argv[i], "--offset") == 0) modifiers->rangeOffset = value;
+            else modifiers->rangeLength = value;
+            i++;
+        }else if (strcmp(argv[i], "--stdout") == 0){ // Extracted files written to the standard output
+            modifiers->stdoutMode = 1;
+        }else if (strcmp(argv[i], "--verify") == 0){ // The checksums are checked when the files are extracted, and calculated when they are added
+            options->verifyMode = 1;
+        }else if (strcmp(argv[i], "--tombstone") == 0){ // Deleted files are only marked in the index
+            options->deleteMode = STAR_DELETE_TOMBSTONE;
+        }else if (strcmp(argv[i], "--concurrent") == 0){ // Other commands with --concurrent can read the tar file while it is written
+            options->lockMode = STAR_LOCK_RANGES;
+        }else if (strcmp(argv[i], "--uring") == 0){ // Small files moved in batches by io_uring
+            options->ioMode = STAR_IO_URING;
+        }else if (strcmp(argv[i], "--quiet") == 0){ // Only the results and the errors are printed
+            options->quietMode = 1;
+        }else if (strcmp(argv[i], "--stats") == 0){ // Counters of the command in JSON
+            modifiers->statsMode = 1;
+        }else if (strcmp(argv[i], "-j") == 0 && i + 1 < *argc){ // Amount of threads
+            options->numThreads = atoi(argv[++i]);
+            if (options->numThreads <= 0) // All the processors
+                options->numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            if (options->numThreads <= 0) options->numThreads = 1;
+        }else{
+            argv[remaining++] = argv[i];
+        }
+    }
+    *argc = remaining;
+    if (options->dedupMode && options->compressionLevel != 0){
+        fprintf(stderr, "--dedup can not be used with --compress or --dictionary.\n");
+        exit(1);
+    }
+}
+
+/*
+    Function to read a list of file names from the standard input, one per line.
+    numFiles is updated with the amount of names read.
+    Returns the names. They are kept until the program ends.
+*/
+static const char ** readFileList(int * numFiles){
+    int capacity = FILE_LIST_CAPACITY;
+    const char ** fileNames = (const char **)malloc(capacity * sizeof(char *));
+    char * line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t length;
+    *numFiles = 0;
+    while (fileNames != NULL && (length = getline(&line, &lineCapacity, stdin)) != -1){
+        if (length > 0 && line[length - 1] == '\n') line[--length] = '\0';
+        if (length == 0) continue; // Empty line
+        if (*numFiles == capacity){
+            capacity *= 2;
+            fileNames = (const char **)realloc(fileNames, capacity * sizeof(char *));
+            if (fileNames == NULL) break;
+        }
+        fileNames[(*numFiles)++] = strdup(line);
+    }
+    free(line);
+    if (fileNames == NULL){
+        fprintf(stderr, "readFileList: Error Malloc for the file names.\n");
+        exit(1);
+    }
+    return fileNames;
+}
+
+/*
+    Function to print the counters of the command (--stats) as one line of JSON in the standard error,
+    which is never used for data, so it can be read by monitoring tools. result is the STAR_* code of the command.
+    fragmentation is the part of the free space that is not in the biggest blank space: 0 if it is all together.
+*/
+static void printStats(struct Star * star, const char * command, int result){
+    struct StarStats stats;
+    starStats(star, &stats);
+    fprintf(stderr, "{\"command\": \"%s\", \"result\": %d, \"seconds\": %.6f, \"phases\": {\"load\": %.6f, \"content\": %.6f, \"flush\": %.6f}, "
+            "\"bytes_read\": %llu, \"bytes_written\": %llu, \"syscalls\": {\"read\": %llu, \"write\": %llu, \"copy\": %llu, \"io_uring\": %llu}, "
+            "\"header_flushes\": %llu, \"free_space\": {\"blank_spaces\": %d, \"bytes\": %lld, \"largest\": %lld, \"fragmentation\": %.4f}}\n",
+            command, result, stats.seconds, stats.phaseSeconds[STAR_PHASE_LOAD], stats.phaseSeconds[STAR_PHASE_CONTENT],
+            stats.phaseSeconds[STAR_PHASE_FLUSH], (unsigned long long)stats.bytesRead, (unsigned long long)stats.bytesWritten,
+            (unsigned long long)stats.readCalls, (unsigned long long)stats.writeCalls, (unsigned long long)stats.copyCalls,
+            (unsigned long long)stats.ringCalls, (unsigned long long)stats.headerFlushes, stats.blankSpaces, (long long)stats.freeBytes,
+            (long long)stats.largestBlankSpace, stats.freeBytes > 0 ? 1.0 - (double)stats.largestBlankSpace / stats.freeBytes : 0.0);
+}
+
+int main(int argc, char *argv[]) {//!Modificar forma de usar las opciones
+    struct StarOptions options;
+    starDefaultOptions(&options);
+    options.output = stdout; // The progress and the lists of the command
+    struct Modifiers modifiers = {0, 0, -1, 0};
+    parseModifiers(&argc, argv, &options, &modifiers);
+    if (argc < 3) {
+        fprintf(stderr, "Use: %s -c|-t|-d|-r|-x|-u|-p|-v [-j threads] [--buffered] [--compress[=level]] [--dictionary] [--dedup] [--mmap] [--tombstone] [--concurrent] [--uring] [--quiet] [--stats] [--verify] [--stdout] [--offset N] [--length M] <tarFile.tar | -> [files | -]\n", argv[0]);
+        exit(1);
+    }
+    const char * opcion = argv[1];
+    const char * tarFileName = argv[2];
+    int numFiles = argc - 3;
+    const char ** fileNames = (const char **)&argv[3];
+    int streamed = strcmp(tarFileName, "-") == 0; // The tar file is the standard output (-c) or input (-x)
+    int ranged = modifiers.rangeOffset != 0 || modifiers.rangeLength != -1;
+    if (streamed && (strlen(opcion) != 2 || (opcion[1] != 'c' && opcion[1] != 'x'))){
+        fprintf(stderr, "Only -c and -x can use the standard output or input as the tar file.\n");
+        exit(1);
+    }
+    if (streamed && opcion[1] == 'c' && (options.compressionLevel != 0 || options.dedupMode)){
+        fprintf(stderr, "A tar file written to the standard output can not be compressed or deduplicated.\n");
+        exit(1);
+    }
+    if (ranged && (strcmp(opcion, "-x") != 0 || streamed || numFiles != 1)){
+        fprintf(stderr, "--offset and --length extract a range of one file: -x <tarFile.tar> <file>\n");
+        exit(1);
+    }
+    if (numFiles == 1 && strcmp(fileNames[0], "-") == 0){ // The names are read from the standard input
+        if (streamed && opcion[1] == 'x'){
+            fprintf(stderr, "The standard input can not have both the tar file and the names of the files.\n");
+            exit(1);
+        }
+        fileNames = readFileList(&numFiles);
+    }
+    int output = -1; // Where the data goes when it is not written to files
+    if (modifiers.stdoutMode || (streamed && opcion[1] == 'c')){ // The data goes to the standard output, and the messages to the standard error
+        fflush(stdout);
+        output = dup(STDOUT_FILENO);
+        if (output == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1){
+            perror("Error using the standard output.");
+            exit(1);
+        }
+    }
+
+    struct Star * star;
+    int result = starOpen(&star, tarFileName, &options);
+    if (result != STAR_OK){
+        fprintf(stderr, "Error opening the tar file: %s.\n", result == STAR_ERROR_MEMORY ? "not enough memory" : "wrong options");
+        exit(1);
+    }
+
+    // Iterate through all options
+    for (int i = 1; i < strlen(opcion) && result == STAR_OK; i++) {
+        char opt = opcion[i];
+        if (opt == 'c'){//* Create
+            if (streamed) result = starCreateStream(star, numFiles, fileNames, output);
+            else result = starCreate(star, numFiles, fileNames);
+        } 
+        else if (opt == 't'){//* List
+            result = starList(star);
+        } 
+        else if (opt == 'd'){//* Delete
+            result = starDelete(star, numFiles, fileNames); // Files to be deleted
+        }
+        else if (opt == 'r'){//* Append
+            result = starAppend(star, numFiles, fileNames); // Files to be added
+        }
+        else if (opt == 'x') {//* Extract
+            if (streamed){ // In one pass from the standard input
+                result = starExtractStream(star, STDIN_FILENO, numFiles, fileNames, output);
+            } else if (ranged){ // Only a range, to the standard output or to the file
+                off_t extracted;
+                result = starExtractRange(star, fileNames[0], modifiers.rangeOffset, modifiers.rangeLength, output, &extracted);
+            } else { // Extract some, or all if there are no files
+                result = starExtract(star, numFiles, fileNames, output);
+            }
+        }
+        else if (opt == 'u'){//* Update
+            result = starUpdate(star, numFiles, fileNames); // Files to be updated
+        }
+        else if (opt == 'p'){//* Pack
+            result = starPack(star);
+        }
+        else if (opt == 'v'){//* Verify
+            result = starVerify(star);
+        }else{
+            fprintf(stderr, "Uso: %s -c|-t|-d|-r|-x <archivoTar> [archivos]\n", argv[0]);
+            exit(1);
+        }
+    }
+    
+    if (result == STAR_OK)
+        result = starSync(star); // Writes the header if it was modified
+    if (modifiers.statsMode)
+        printStats(star, opcion, result);
+    if (result != STAR_OK){
+        fprintf(stderr, "%s\n", starErrorMessage(star));
+        starClose(star);
+        // Missing files and corrupted content have their own exit codes
+        exit(result == STAR_ERROR_NOT_FOUND ? 11 : result == STAR_ERROR_CORRUPTED ? 12 : 1);
+    }
+    off_t size = starSize(star);
+    starClose(star);
+
+    if (!options.quietMode){
+        printf("----------------------------------------------------\n");
+        printf("Size of tar file is of: %ld bytes.\n", (long)size);
+        printf("PROGRAM ENDS SUCCESSFULLY\n");
+    }
+    
+    return 0;
+}
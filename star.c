@@ -1,1041 +1,5251 @@
+#define _GNU_SOURCE // copy_file_range and splice
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <zlib.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h> // Used through its system calls, liburing is not needed
+#include <sys/syscall.h>
+#define URING_AVAILABLE
+#endif
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h> // crc32 instruction of SSE4.2
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#include "star.h"
 
-#define MAX_FILENAME_LENGTH 100
-#define MAX_FILES 100
+#ifndef F_OFD_SETLKW // Without locks of the open file, the locks are of the process, shared by all its handles
+#define F_OFD_SETLK F_SETLK
+#define F_OFD_SETLKW F_SETLKW
+#endif
+
+#define COPY_BUFFER_SIZE (64 * 1024) // Size of the buffer used to move content between files
+#define ERROR_MESSAGE_SIZE 512 // Maximum length of the description of an error
+#define SPOOL_NAME_SIZE 4096 // Maximum length of the name of the spool of compressFiles and dedupFiles
+
+#define STAR_MAGIC "STAR" // First bytes of every tar file
+#define STREAM_FILE_MAGIC "STRF" // Record of a file in a streamed tar file
+#define STREAM_END_MAGIC "STRE" // Record after the last file of a streamed tar file
+#define STAR_VERSION 4 // Version of the index format. Version 1 is the old fixed header of 100 files. Version 4 adds the checksums
+#define MIN_STAR_VERSION 2 // Oldest version of the superblock that can be read
+#define SUPERBLOCK_SIZE 512 // Bytes reserved at the start of the tar file for the superblock
+#define BODY_ALIGNMENT 4096 // The content of the first file starts at a multiple of this
+#define MIN_INDEX_SLOTS 16 // Minimum amount of entries reserved in the index
+#define MIN_NAMES_CAPACITY 1024 // Minimum amount of bytes reserved for the names in the index
+#define ENTRY_DELETED 1 // Flag of the index entries whose file was deleted
+#define ENTRY_COMPRESSED 2 // Flag of the index entries whose content is stored in compressed blocks
+#define ENTRY_CHUNKED 4 // Flag of the index entries whose content is a list of chunks
+#define ENTRY_CHECKSUM 8 // Flag of the index entries that have the checksum of their content
+#define FEATURE_FREE_MAP 1 // The tar file has its blank spaces saved in the free map
+#define FEATURE_COMPRESSION 2 // The tar file has compressed files
+#define FEATURE_DICTIONARY 4 // The tar file has a dictionary shared by its small compressed files
+#define FEATURE_DEDUP 8 // The tar file has a chunk table for its deduplicated files
+#define FEATURE_STREAMED 16 // The tar file was written in one pass (-c -). Its superblock is repeated at the end, after the index
+#define KNOWN_FEATURES (FEATURE_FREE_MAP | FEATURE_COMPRESSION | FEATURE_DICTIONARY | FEATURE_DEDUP | FEATURE_STREAMED) // Features this version can read
+#define COMPRESSION_BLOCK_SIZE (128 * 1024) // Bytes of a file compressed independently
+#define BLOCK_STORED_RAW 0x80000000u // Flag of the table of blocks: the block did not get smaller and is stored as it is
+#define DICTIONARY_SIZE (32 * 1024) // Maximum size of the dictionary. zlib does not look further back
+#define DICTIONARY_MEMBER_LIMIT (64 * 1024) // Files up to this size are compressed with the dictionary
+#define DICTIONARY_SAMPLE_LIMIT (1024 * 1024) // Bytes of small files read to train the dictionary
+#define DICTIONARY_MIN_SAMPLES 8 // Small files needed to train the dictionary
+#define DICTIONARY_SEGMENT_SIZE 256 // Bytes of the samples copied at a time to the dictionary
+#define DICTIONARY_KMER 8 // Bytes of the sequences counted to train the dictionary
+#define DICTIONARY_HASH_BITS 20 // Size of the table of counts of the sequences
+#define CHUNK_MIN_SIZE 2048 // Sizes of the chunks of the deduplicated files
+#define CHUNK_MAX_SIZE (64 * 1024)
+#define CHUNK_MASK (((1ULL << 13) - 1) << 51) // Top 13 bits of the rolling hash: chunks of 8 KiB on average
+#define DEDUP_BUFFER_SIZE (1024 * 1024) // Bytes of a file read at a time to cut it in chunks
+#define CRC32C_POLYNOMIAL 0x82F63B78u // Castagnoli polynomial, reflected. The same as the crc32 instruction
+#define MIN_FREE_MAP_CAPACITY 4096 // Minimum amount of bytes reserved for the free map
+#define BY_START 0 // Tree of blank spaces sorted by start
+#define BY_SIZE 1 // Tree of blank spaces sorted by size
+#define PACK_INDEX -1 // Item of pack that is the index, instead of a file
+#define PACK_DICTIONARY -2 // Item of pack that is the dictionary
+#define PACK_CHUNK_TABLE -3 // Item of pack that is the chunk table
+#define PACK_FIRST_CHUNK -4 // Item of pack that is the chunk 0. The chunk N is PACK_FIRST_CHUNK - N
+#define NAME_INDEX_EMPTY -1 // Position of the name index that was never used
+#define NAME_INDEX_REMOVED -2 // Position of the name index whose file was removed
+#define RING_ENTRIES 128 // Operations in the queues of io_uring (--uring)
+#define RING_BATCH 64 // Members moved at a time by io_uring. Each one needs two operations, the read and the write
+#define SMALL_MEMBER_LIMIT (64 * 1024) // Members up to this size are moved in batches. The time of the bigger ones is not in the system calls
+#define VECTOR_RUN_SIZE (1024 * 1024) // Bytes of adjacent members moved by one preadv or pwritev
+#define VECTOR_RUN_MEMBERS 512 // Members of one preadv or pwritev. With their gaps, under IOV_MAX (1024 in Linux)
+#define VECTOR_GAP_LIMIT 4096 // Bytes between two members that are read and thrown away to read both with one preadv
+#define RING_OPEN 0 // Steps of a member moved by io_uring
+#define RING_READ 1
+#define RING_WRITE 2
+#define RING_CLOSE 3
+#define RING_MOVED (RING_READ | RING_WRITE) // Steps that moved all the bytes when a member is done
+#define IO_READ 0 // Kinds of system calls counted by countCall
+#define IO_WRITE 1
+#define IO_COPY 2 // Reads and writes the bytes inside the kernel
+#define IO_MAPPED 3 // Not a system call: bytes read from the mapping of the tar file
+#define LOCK_HEADER_POSITION 0 // Byte locked by the readers while they read the header, and by the writer while it writes it (--concurrent)
+#define LOCK_WRITER_POSITION 1 // Byte locked by the writer during its whole session, so there is only one
+
+#define LEGACY_MAX_FILENAME_LENGTH 100 // Sizes of the version 1 header
+#define LEGACY_MAX_FILES 100
+
+/*
+    Superblock. Stored at the start of the tar file and tells where the index is.
+    The index is a block of 'indexCapacity' bytes: first 'slotCapacity' entries (struct IndexEntry),
+    then the names table, where every name is stored followed by '\0'.
+    The index can be anywhere in the tar file. When it gets full it is moved to a bigger block.
+*/
+struct Superblock {
+    char magic[4]; // STAR_MAGIC
+    uint32_t version; // STAR_VERSION
+    uint64_t indexStart; // Position of the index in the tar file
+    uint64_t indexCapacity; // Bytes reserved for the index
+    uint64_t namesSize; // Bytes used in the names table
+    uint64_t bodyStart; // Position where the content of the files starts
+    uint32_t numEntries; // Entries used in the index
+    uint32_t slotCapacity; // Entries that fit in the index before the names table
+    // Since version 3. The rest of the SUPERBLOCK_SIZE bytes are zeros, so new fields can be added with a feature
+    uint32_t features; // FEATURE_* flags
+    uint32_t numBlankSpaces; // Blank spaces stored in the free map
+    uint64_t freeMapStart; // Position of the free map: array of struct FreeMapEntry
+    uint64_t freeMapCapacity; // Bytes reserved for the free map
+    uint64_t dictionaryStart; // Position of the dictionary. Only with FEATURE_DICTIONARY
+    uint64_t dictionarySize; // Bytes of the dictionary
+    uint64_t chunkTableStart; // Position of the chunk table: array of struct ChunkEntry. Only with FEATURE_DEDUP
+    uint64_t chunkTableCapacity; // Bytes reserved for the chunk table
+    uint64_t numChunks; // Entries used in the chunk table, including the free ones
+    uint64_t generation; // Times the header was written. Older versions leave it as zero. It does not need a feature, it does not change how the tar file is read
+};
+
+/*
+    Record before the content of every file of a streamed tar file, followed by the name (without '\0').
+    The content is followed by its CRC32C (uint32_t). With these records the files can be extracted in one pass,
+    without the index at the end.
+*/
+struct StreamRecord {
+    char magic[4]; // STREAM_FILE_MAGIC, or STREAM_END_MAGIC after the last file
+    uint32_t nameLength;
+    uint64_t size;
+    uint32_t mode;
+    uint32_t reserved; // Zeros
+};
+
+/*
+    Blank space as it is stored in the free map of the tar file.
+*/
+struct FreeMapEntry {
+    uint64_t start;
+    uint64_t end;
+};
+
+/*
+    Entry of the index as it is stored in the tar file. One for every position of the header's file list.
+*/
+struct IndexEntry {
+    uint64_t size; // Size of the file. If it is compressed or chunked, 'end' - 'start' are the bytes stored
+    uint64_t start;
+    uint64_t end;
+    uint32_t mode;
+    uint32_t flags; // ENTRY_DELETED, ENTRY_COMPRESSED, ENTRY_CHUNKED, ENTRY_CHECKSUM
+    uint32_t nameOffset; // Position of the name in the names table
+    uint32_t nameLength; // Length of the name without the '\0'
+    uint32_t checksum; // CRC32C of the bytes stored, from 'start' to 'end'. Only with ENTRY_CHECKSUM
+    uint32_t reserved; // Zeros
+};
+
+/*
+    Entry of the index of versions 2 and 3, without checksum. Only used to read old tar files.
+*/
+struct LegacyIndexEntry {
+    uint64_t size;
+    uint64_t start;
+    uint64_t end;
+    uint32_t mode;
+    uint32_t flags;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+};
+
+/*
+    File of the version 1 header. Only used to read old tar files.
+*/
+struct LegacyFile {
+    char fileName[LEGACY_MAX_FILENAME_LENGTH];
+    mode_t mode;
+    off_t size;
+    off_t start;
+    off_t end;
+    int deleted;
+};
 
 struct File {
-    char fileName[MAX_FILENAME_LENGTH];
+    char * fileName; // Stored in the names of the header
     mode_t mode;
-    off_t size; // 0: No file, > 0: Yes file
+    off_t size; // 0: No file, > 0: Yes file. Bytes stored in the tar file
     off_t start;
     off_t end;
     int deleted;//0: No, 1: Yes
+    off_t originalSize; // Size of the file before compression
+    int compressed; // 0: No, 1: Stored in compressed blocks
+    int chunked; // 0: No, 1: Stored as a list of identifiers of chunks
+    uint32_t checksum; // CRC32C of the bytes stored in the tar file
+    int checksummed; // 0: No checksum (older versions), 1: checksum is valid
+    off_t nameOffset; // Position of the name in the names table of the tar file. -1 if it is not written yet
+    int dirty; // 1 if the entry changed since the index was written
+};
+
+/*
+    Block of memory where the names of the files are stored.
+    Blocks are never moved, so the names can be referenced while new ones are added.
+*/
+struct NameBlock {
+    struct NameBlock * nextBlock;
+    size_t used;
+    size_t capacity;
+    char names[];
 };
 
 struct Header{
-    struct File fileList[MAX_FILES];
-} header; // declaration of header
+    struct File * fileList; // Grows when needed
+    int numEntries; // Used positions of fileList (files, deleted files and empty positions)
+    int capacity; // Allocated positions of fileList
+    struct NameBlock * names; // Names of the files
+    off_t indexStart; // Position of the index in the tar file
+    off_t indexCapacity; // Bytes reserved for the index in the tar file
+    int slotCapacity; // Entries that fit in the index before the names table
+    off_t bodyStart; // Position where the content of the files starts
+    int * nameIndex; // Hash table from the name of a file to its position in fileList
+    int nameIndexSize; // Positions of nameIndex. Always a power of 2
+    int nameIndexUsed; // Positions of nameIndex that are not NAME_INDEX_EMPTY
+    int loaded; // 1 if the header of the tar file is in memory
+    int namesMapped; // 1 if the names are used directly from the mapping of the tar file (--mmap)
+    int oldFormat; // 1 if the index in the tar file has the format of an older version, so it is written whole before any entry
+    off_t namesSize; // Bytes used in the names table of the tar file. Includes the old names of reused positions
+    int * dirtyEntries; // Positions of fileList whose entry must be written, in the order they changed
+    int numDirty;
+    int dirtyCapacity;
+    uint64_t generation; // Generation of the header in the tar file when it was read. It is not reset when the header is released
+};
 
+/*
+    Blank space of the tar file, from 'start' to 'end' (not included).
+    Every blank space is a node of two trees (treaps): one sorted by start and one sorted by size.
+    The tree by start is used to join neighbouring blank spaces, and the tree by size to find the best fit.
+*/
 struct BlankSpace{
     off_t start;
     off_t end;
-    int index;
-    struct BlankSpace * nextBlankSpace;
-} * firstBlankSpace; // declaration of blank spaces
+    unsigned int priority; // Random. The node with the highest priority is the root, so the trees stay balanced
+    struct BlankSpace * left[2]; // [BY_START] and [BY_SIZE]
+    struct BlankSpace * right[2];
+};
+
+/*
+    Blank spaces of the tar file.
+    They are saved in the tar file (the free map) so they do not need to be calculated for every command.
+*/
+struct FreeSpace{
+    struct BlankSpace * root[2]; // Roots of the trees [BY_START] and [BY_SIZE]
+    int numBlankSpaces;
+    off_t totalSize; // Sum of the sizes of all the blank spaces
+    int loaded; // 1 if the blank spaces are in memory
+    off_t mapStart; // Position of the free map in the tar file. 0 if there is no free map
+    off_t mapCapacity; // Bytes reserved for the free map
+    int mapCount; // Blank spaces stored in the free map
+    int mapValid; // 1 if the tar file has a free map (it can be empty)
+};
+
+/*
+    Session with the tar file of the command.
+    The tar file is opened once, and its header and size are kept in memory until the session is closed,
+    when the header is written if it was modified.
+*/
+struct Session {
+    int tarFile; // -1 if the tar file is not opened
+    off_t size; // Size of the tar file
+    int dirty; // 1 if the header was modified and has not been written
+    const char * map; // Mapping of the tar file for reading (--mmap). NULL if it is not mapped
+    off_t mapSize; // Bytes of the tar file in the mapping
+    int writer; // 1 if it has the lock of the writer (--concurrent). It keeps it, and the ranges it changed, until it is closed
+    int pinned; // 1 if the files of the current operation are pinned (--concurrent)
+};
+
+/*
+    Dictionary of the tar file. Trained from the small files when the tar file is created with --dictionary,
+    and used to compress and decompress every small file, which are too small to compress well alone.
+    It is kept in memory while the tar file is opened.
+*/
+struct Dictionary {
+    unsigned char * data; // NULL if the tar file has no dictionary
+    off_t start; // Position in the tar file. 0 if it was not written yet
+    off_t size;
+};
+
+/*
+    Chunk of the deduplicated files, as it is stored in the chunk table of the tar file.
+    Every different chunk is stored once, and the files that have it point to it by its position in the table.
+*/
+struct ChunkEntry {
+    uint64_t hash; // hashChunk of the content
+    uint64_t start; // Position in the tar file
+    uint32_t size; // 0 if the position of the table is free
+    uint32_t references; // Amount of times it is in the lists of the files
+};
+
+/*
+    Chunk table of the tar file. Kept in memory while the tar file is opened, and written with the header.
+*/
+struct ChunkStore {
+    struct ChunkEntry * chunks; // The position is the identifier of the chunk
+    int numChunks; // Positions used, including the free ones
+    int capacity;
+    int firstFree; // No position before this one is free
+    int * hashIndex; // Open addressing table of identifiers of chunks, by hash
+    int hashIndexSize; // Power of two
+    int hashIndexUsed; // Positions of the hash index that are not empty
+    off_t end; // End of the last chunk in the tar file
+    off_t tableStart; // Position of the chunk table in the tar file. 0 if it was not written yet
+    off_t tableCapacity; // Bytes reserved for the chunk table
+};
+
+/*
+    Names prepared to be written in the names table of the index.
+*/
+struct NamesWriter {
+    struct Star * star;
+    int tarFile;
+    off_t namesStart; // Position of the names table in the tar file
+    char block[COPY_BUFFER_SIZE];
+    size_t namesInBlock;
+    off_t namesWritten; // Position in the names table of the first name of the block
+};
+
+/*
+    Handle of the library: everything that is known of one tar file while it is opened, and the options it is used with.
+    Nothing is shared between handles, so each one can be used by a different thread.
+    The threads of runInParallel share the handle of their operation: they only read it, except where a lock is used.
+*/
+struct Star {
+    char * tarFileName;
+    struct StarOptions options;
+    struct Header header;
+    struct FreeSpace freeSpace;
+    struct Session session;
+    struct Dictionary dictionary;
+    struct ChunkStore chunkStore;
+    int streamOutput; // File written in order, like the standard output: the streamed tar file (-c -) or the extracted files (--stdout). -1 if none
+    unsigned int prioritySeed; // State of randomPriority
+    struct NamesWriter namesWriter; // Too big for the stack of the threads
+    int errorCode; // STAR_OK, or the first error of the current operation
+    char errorMessage[ERROR_MESSAGE_SIZE];
+    pthread_mutex_t errorLock; // The threads of an operation can fail at the same time
+    struct StarStats stats; // Counters of starStats. The ones of the system calls are updated by every thread
+    double operationStart; // When the current operation started
+    double measuredSeconds; // Seconds of the load and flush phases when the current operation started
+};
+
+static uint64_t gearTable[256]; // Values of the bytes for the rolling hash of the chunker. The same for every handle
+static uint32_t crc32cTable[8][256]; // Tables of the CRC32C without the crc32 instruction (slicing by 8)
+static int crc32cInstruction = 0; // 1 if the processor has the crc32 instruction
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT; // The tables are filled once, by the first handle that is opened
+
+/*
+    Function to print a message about the progress of an operation to the output of the options, like printf.
+    Nothing is printed without output or with quietMode, so scripts that handle many files do not pay for the messages.
+*/
+static void report(struct Star * star, const char * format, ...){
+    if (star->options.output == NULL || star->options.quietMode) return;
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(star->options.output, format, arguments);
+    va_end(arguments);
+}
 
-off_t currentPosition = 0; // Tracks the current position in tar file
-int numFiles=0;
+/*
+    Function to register an error of the current operation of the handle.
+    Only the first one is kept, the next ones are usually a consequence of it.
+    code is one of STAR_ERROR_*, and format and the rest of arguments are the description, like in printf.
+    Returns -1, so the functions that fail can return it directly.
+*/
+static int setError(struct Star * star, int code, const char * format, ...){
+    pthread_mutex_lock(&star->errorLock);
+    if (star->errorCode == STAR_OK){
+        va_list arguments;
+        va_start(arguments, format);
+        vsnprintf(star->errorMessage, sizeof(star->errorMessage), format, arguments);
+        va_end(arguments);
+        star->errorCode = code;
+    }
+    pthread_mutex_unlock(&star->errorLock);
+    return -1;
+}
 
 /*
     Function to open or create a file.
     fileName is the name of the file to open or create.
     option is 0 for open and 1 for create.
-    if 1, the file is created empty.
+    if 1, the file is created empty. 3 is the same, but the file can also be read.
     if 0 the file is opened in read and write mode without deleting its contents.
+    Returns -1 if error.
 */
-int openFile(const char * fileName,int option){
+static int openFile(struct Star * star, const char * fileName,int option){
     int fd;
     if (option==0){ // Reading and writing without deleting content
         fd = open(fileName, O_RDWR  | O_CREAT, 0666);
-        if (fd == -1) {
-            perror("Error creating the packed file");
-            exit(1);
-        }
         //printf("File opened in option: 0 -> O_RDWR  | O_CREAT\n");
-        return fd;
     }else if (option==1){ // Create empty file
         fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-        if (fd == -1) {
-            perror("Error creating the packed file");
-            exit(1);
-        }
         //printf("File opened in option: 1 -> O_WRONLY | O_CREAT | O_TRUNC\n");
-        return fd;
+    }else if (option==3){ // Create empty file that can also be read
+        fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0666);
     }else if (option==2){ //Extend the file (for the body)
         fd = open(fileName, O_WRONLY | O_APPEND, 0666);
-        if (fd == -1) {
-            perror("Error creating the packed file");
-            exit(1);
-        }
         //printf("File opened in option: 2 -> O_WRONLY | O_APPEND\n");
-        return fd;
     }else{
-        printf("File creation/opening option wrong...\n");
-        return -1;
+        return setError(star, STAR_ERROR_ARGUMENT, "openFile: File creation/opening option wrong.");
     }
+    if (fd == -1)
+        return setError(star, STAR_ERROR_IO, "openFile: Error creating \"%s\": %s.", fileName, strerror(errno));
+    return fd;
 }
 
 /*
-    Function that receives the name of a file and returns its size
+    Function to obtain the identifier of the tar file of the session.
+    The first time, the tar file is opened (or created if 'create' is 1) and its size is saved.
+    If it is already opened and 'create' is 1, it is emptied.
+    The identifier is valid until the session is closed, so it must not be closed by the caller.
+    Returns -1 if error.
 */
-off_t getFileSize(const char * fileName){
-    int file = openFile(fileName,0);
-    off_t sizeOfFile = lseek(file, 0, SEEK_END); // Obtains size of file
-    if (sizeOfFile == -1) {
-        perror("getFileSize: Error getting size of file.");
-        close(file);
-        exit(1);
+static int openSession(struct Star * star, const char * tarFileName, int create){
+    if (star->session.tarFile != -1 && create){ // Opened by an operation before, or to lock it before it is emptied (--concurrent)
+        if (ftruncate(star->session.tarFile, 0) == -1)
+            return setError(star, STAR_ERROR_IO, "openSession: Error emptying the tar file: %s.", strerror(errno));
+        star->session.size = 0;
+    }
+    if (star->session.tarFile != -1) return star->session.tarFile;
+    int tarFile = openFile(star, tarFileName, create ? 3 : 0);
+    if (tarFile == -1) return -1;
+    struct stat tarStat;
+    if (fstat(tarFile, &tarStat) == -1){
+        close(tarFile);
+        return setError(star, STAR_ERROR_IO, "openSession: Error getting size of tar file: %s.", strerror(errno));
     }
-    close(file);
-    return sizeOfFile;
+    star->session.tarFile = tarFile;
+    star->session.size = tarStat.st_size;
+    star->session.dirty = 0;
+    return star->session.tarFile;
 }
 
 /*
-    Returns the size in bytes of the sum of the sizes of the files contained in the tar file.
+    Function to register that the tar file was written until 'end'.
+    Keeps the size of the session up to date without asking the system.
 */
-off_t getSizeOfContents(){
-    off_t totalSum = 0;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (header.fileList[i].size!=0){
-            totalSum += header.fileList[i].size;
-        }
+static void growSession(struct Star * star, off_t end){
+    if (end > star->session.size) star->session.size = end;
+}
+
+/*
+    Function to map the whole tar file of the session in memory, only for reading.
+    The mapping is valid until the session is closed.
+    Returns NULL if the tar file cannot be mapped, and then it is read with system calls.
+*/
+static const char * mapSession(struct Star * star){
+    if (star->session.map != NULL) return star->session.map;
+    if (star->session.tarFile == -1 || star->session.size == 0) return NULL;
+    void * map = mmap(NULL, star->session.size, PROT_READ, MAP_SHARED, star->session.tarFile, 0);
+    if (map == MAP_FAILED){
+        report(star, "The tar file can not be mapped, it is read without mapping: %s.\n", strerror(errno));
+        star->options.readMode = STAR_READ_DEFAULT;
+        return NULL;
     }
-    return totalSum;
+    star->session.map = map;
+    star->session.mapSize = star->session.size;
+    return star->session.map;
 }
 
 /*
-    Function to save a file in header.
-    CAUTION: Only saves in NULL positions of the Files array. Checks from start to finish.
+    Function to lock 'length' bytes of the tar file from 'start', or until its end, wherever it is, if length is 0 (--concurrent).
+    type is F_RDLCK (shared with other readers), F_WRLCK (only for the writer) or F_UNLCK.
+    If wait is 1 it waits until nobody else has the range.
+    The locks are of the opened tar file, so they are released when the session is closed.
+    Returns 0 if locked, 1 if the range is used by someone else and wait is 0, and -1 on error.
 */
-void addFileToHeaderFileList(struct File newFile) {
-    printf("Adding \"%s\" to header's file list.\n", newFile.fileName);
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (header.fileList[i].size==0){ // Empty position
-            header.fileList[i]= newFile;
-            numFiles++;
-            break;
-        }
+static int lockRange(struct Star * star, int tarFile, off_t start, off_t length, short type, int wait){
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock)); // l_pid must be 0
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = length;
+    while (fcntl(tarFile, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lock) == -1){
+        if (errno == EINTR) continue;
+        if (!wait && (errno == EAGAIN || errno == EACCES)) return 1;
+        return setError(star, STAR_ERROR_IO, "lockRange: Error locking the tar file: %s.", strerror(errno));
     }
+    return 0;
 }
 
 /*
-    Function to find the index of the last file in the header.
-    Returns the array index of that last file.
-    Returns -1 if there are no files.
+    Function to lock the range from 'start' to 'end' before the writer changes it (--concurrent).
+    It waits for the readers that pinned files in the range, and the readers that come later wait until the header is written.
+    Returns -1 on error.
 */
-int findIndexLastFileInHeader(){
-    for (int i = MAX_FILES-1; i >= 0; i--) 
-        if (header.fileList[i].size !=  0) 
-            return i;
-    return -1;
-} 
+static int lockContent(struct Star * star, off_t start, off_t end){
+    if (!star->session.writer || end <= start) return 0;
+    return lockRange(star, star->session.tarFile, start, end - start, F_WRLCK, 1);
+}
 
 /*
-    Function to add a file as last in header.
-    NOT as the last of the array, but that this new file is the last in the list of files.
+    Function to read the size of the tar file of the session again, when another command could have changed it (--concurrent).
+    Returns -1 on error.
 */
-void addFileToHeaderListInLastPosition(struct File newFile){
-    int lastPosition = findIndexLastFileInHeader();
-    if (lastPosition==-1){
-        printf("There are no files.\n");
-        header.fileList[0] = newFile;
-        return;
-    }
-    if (lastPosition==MAX_FILES-1){
-        printf("No space in header.\n");
-        exit(1);
-    }
-    header.fileList[lastPosition+1] = newFile;
+static int refreshSessionSize(struct Star * star){
+    struct stat tarStat;
+    if (fstat(star->session.tarFile, &tarStat) == -1)
+        return setError(star, STAR_ERROR_IO, "refreshSessionSize: Error getting size of tar file: %s.", strerror(errno));
+    star->session.size = tarStat.st_size;
+    return 0;
 }
 
 /*
-    Function to count how many files there are in tar.
-    Returns the amount of files in the tar.
+    Returns the size in bytes of the sum of the sizes of the files contained in the tar file.
 */
-int sumFiles(){
-    for (int i =0; i<MAX_FILES ; i++){
-        if (header.fileList[i].size!=0)
-            numFiles++;
+static off_t getSizeOfContents(struct Star * star){
+    off_t totalSum = 0;
+    for (int i = 0; i < star->header.numEntries; i++) {
+        if (star->header.fileList[i].size!=0){
+            totalSum += star->header.fileList[i].size;
+        }
     }
-    return numFiles;
+    return totalSum;
 }
 
 /*
-    Function that modifies the start and end position of the existent files.
-    It reallocates the start and end position of each file in way that these positions are secuencials, and so are the files.
-    Returns an array of the new files information.
+    Function to store a name in the names of the header.
+    Returns the stored copy, which is valid until the header is read again, or NULL if error.
 */
-struct File * modifiedExistentFiles(int sumFiles){
-    struct File* modifiedFiles = (struct File*)malloc(sumFiles * sizeof(struct File));
-    int bytePosition = 0;
-    int selectedCount = 0;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (header.fileList[i].size != 0){
-            struct File modifiedFile = header.fileList[i];
-            // New positions
-            if (bytePosition == 0) modifiedFile.start = bytePosition = sizeof(header)+1;
-            else modifiedFile.start = currentPosition;
-            
-            modifiedFile.end = currentPosition = modifiedFile.start + modifiedFile.size;
-            
-            modifiedFiles[selectedCount] = modifiedFile;
-            selectedCount++;
+static char * storeName(struct Star * star, const char * name){
+    size_t length = strlen(name) + 1;
+    struct NameBlock * block = star->header.names;
+    if (block == NULL || block->capacity - block->used < length){ // New block, the others are not moved
+        size_t capacity = length > MIN_NAMES_CAPACITY ? length : MIN_NAMES_CAPACITY;
+        block = (struct NameBlock *)malloc(sizeof(struct NameBlock) + capacity);
+        if (block == NULL){
+            setError(star, STAR_ERROR_MEMORY, "storeName: Error Malloc for names.");
+            return NULL;
         }
-    } 
-    return modifiedFiles;
+        block->used = 0;
+        block->capacity = capacity;
+        block->nextBlock = star->header.names;
+        star->header.names = block;
+    }
+    char * storedName = block->names + block->used;
+    memcpy(storedName, name, length);
+    block->used += length;
+    return storedName;
 }
 
 /*
-    Changes the size of a file to the indicated size.
+    Function to register that the header was modified. It is written when the session is closed.
+    If the names are in the mapping of the tar file, they are copied first, because writing the index can overwrite them.
+    Returns -1 if error.
 */
-void truncateFile(const char * fileName, off_t newSize){
-    int file = openFile(fileName, 0);
-    if (file == -1) {
-        perror("truncateFile: Error opening file.");
-        exit(1);
-    }
-    
-    // Uses ftruncate to change the size
-    if (ftruncate(file, newSize) == -1) {
-        perror("truncateFile: Error changing the size of the file.");
-        close(file);
-        exit(1);
+static int markHeaderDirty(struct Star * star){
+    if (star->header.namesMapped){
+        for (int i = 0; i < star->header.numEntries; i++){
+            if (star->header.fileList[i].fileName == NULL) continue;
+            char * fileName = storeName(star, star->header.fileList[i].fileName);
+            if (fileName == NULL) return -1;
+            star->header.fileList[i].fileName = fileName;
+        }
+        star->header.namesMapped = 0;
     }
-    close(file);
+    star->session.dirty = 1;
+    return 0;
 }
 
-/*  
-    Function to read the header from the tar file.
-    Receives the indentifier of the tar file from which the header should be read.
-    Returns 1 if read correctly.
-    DOES NOT close the tar file.
+/*
+    Function to make sure the file list of the header has space for 'numEntries' positions.
+    The new positions are empty.
+    Returns -1 if error.
 */
-int readHeaderFromTar(int tarFile){
-    if (lseek(tarFile, 0, SEEK_SET) == -1) {
-        perror("readHeaderFromTar: Error positioning the pointer at the beginning of the file.");
-        close(tarFile);
-        exit(1);
-    }
-    char headerBlock[sizeof(header)]; // Should be big enough to contain the header
-    ssize_t bytesRead = read(tarFile, headerBlock, sizeof(headerBlock));
-    if (bytesRead < 0) {
-        perror("readHeaderFromTar: Error reading header from tar file.");
-        exit(1);
-    } else if (bytesRead < sizeof(header)) {
-        fprintf(stderr, "readHeaderFromTar: It was not possible to read all the header from tar file.\n");
-        exit(1);
-    }
-    memcpy(&header, headerBlock, sizeof(header)); // Copies the content to the 'header' struct.
-    return 1;
+static int ensureHeaderCapacity(struct Star * star, int numEntries){
+    if (numEntries <= star->header.capacity) return 0;
+    int newCapacity = star->header.capacity == 0 ? MIN_INDEX_SLOTS : star->header.capacity;
+    while (newCapacity < numEntries) newCapacity *= 2;
+    struct File * newList = (struct File *)realloc(star->header.fileList, newCapacity * sizeof(struct File));
+    if (newList == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "ensureHeaderCapacity: Error Malloc for file list.");
+    memset(newList + star->header.capacity, 0, (newCapacity - star->header.capacity) * sizeof(struct File));
+    star->header.fileList = newList;
+    star->header.capacity = newCapacity;
+    return 0;
 }
 
 /*
-    Function to read the content of a file in the tar.
-    Returns the content in a buffer.
-    If error, returns NULL
+    Returns the hash of a name (FNV-1a).
 */
-char * readContentFromTar(int tarFile, struct File fileToRead){
-    if(lseek(tarFile, fileToRead.start, SEEK_SET) == -1){ // Puts pointer of the file tar at the start of the content to be extracted
-        perror("readContentFromTar: Error positioning the pointer at the beginning of the file to be extracted.");
-        close(tarFile);
-        return NULL;
-    }
-
-    char* buffer = (char*)malloc(fileToRead.size); // To store content
-
-    if (read(tarFile, buffer, fileToRead.size) == -1){ // Reads content in 'buffer'
-        perror("readContentFromTar: Error reading the file content from tar.");
-        free(buffer); // liberates buffer
-        close(tarFile);
-        return NULL;
+static uint64_t hashName(const char * name){
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name != '\0'; name++){
+        hash ^= (unsigned char)*name;
+        hash *= 1099511628211ULL;
     }
-
-    close(tarFile);
-    return buffer;
+    return hash;
 }
 
 /*
-    Function to find a file in the tar file.
-    Returns a file struct.
-    If not found, the file returned has size = 0;
-*/
-struct File findFile(const char * tarFileName,const char * fileName){
-    int tarFile = openFile(tarFileName,0);
-    if (readHeaderFromTar(tarFile)==1){
-        for (int i = 0; i < MAX_FILES; i++) {
-            if (strcmp(header.fileList[i].fileName,fileName)==0){//Encontro el archivo
-                close(tarFile);
-                return header.fileList[i];
-            }
+    Function to build the name index again with the files of the header.
+    Its size is at least twice the amount of positions of the file list.
+    Returns -1 if error.
+*/
+static int rebuildNameIndex(struct Star * star){
+    int size = 64;
+    while (size < star->header.numEntries * 2) size *= 2;
+    if (size != star->header.nameIndexSize){
+        free(star->header.nameIndex);
+        star->header.nameIndex = (int *)malloc(size * sizeof(int));
+        if (star->header.nameIndex == NULL){
+            star->header.nameIndexSize = 0;
+            return setError(star, STAR_ERROR_MEMORY, "rebuildNameIndex: Error Malloc for name index.");
         }
-    }else{
-        printf("findFile: Error reading header from tar.\n");
-        close(tarFile);
-        exit(10);
+        star->header.nameIndexSize = size;
     }
-    close(tarFile);
-    printf("findFile: File not found.\n");
-    struct File notFound;
-    notFound.size=0;
-    return notFound;
+    for (int i = 0; i < size; i++)
+        star->header.nameIndex[i] = NAME_INDEX_EMPTY;
+    star->header.nameIndexUsed = 0;
+    for (int i = 0; i < star->header.numEntries; i++){
+        if (star->header.fileList[i].size == 0) continue; // Only existent files
+        int position = hashName(star->header.fileList[i].fileName) & (size - 1);
+        while (star->header.nameIndex[position] != NAME_INDEX_EMPTY)
+            position = (position + 1) & (size - 1);
+        star->header.nameIndex[position] = i;
+        star->header.nameIndexUsed++;
+    }
+    return 0;
 }
 
 /*
-    Functino to find the position of a file in the tar header.
-    Returns -1 if the file is not found.
-    Returns the index of the file from the file list in header.
+    Function to add a file of the header to the name index.
+    index is the position of the file in the file list.
+    If the name index gets too full, it is built again.
+    Returns -1 if error.
 */
-int findIndexFile(const char * tarFileName,const char * fileName){
-    int tarFile = openFile(tarFileName,0);
-    if (readHeaderFromTar(tarFile)==1){
-        for (int i = 0; i < MAX_FILES; i++) {
-            if (strcmp(header.fileList[i].fileName,fileName)==0){ // File found
-                close(tarFile);
-                return i;
-            }
-        }
-    }else{
-        printf("findFile: Error 1 reading header from tar.\n");
-        close(tarFile);
-        exit(10);
-    }
-    close(tarFile);
-    printf("findFile: Error file not found.\n");
-    return -1;
+static int addToNameIndex(struct Star * star, int index){
+    if ((star->header.nameIndexUsed + 1) * 4 > star->header.nameIndexSize * 3) // More than 75% used
+        return rebuildNameIndex(star); // Already includes the file
+    int position = hashName(star->header.fileList[index].fileName) & (star->header.nameIndexSize - 1);
+    while (star->header.nameIndex[position] >= 0)
+        position = (position + 1) & (star->header.nameIndexSize - 1);
+    if (star->header.nameIndex[position] == NAME_INDEX_EMPTY)
+        star->header.nameIndexUsed++;
+    star->header.nameIndex[position] = index;
+    return 0;
 }
 
 /*
-    Function to print header
+    Function to remove a file of the header from the name index.
+    index is the position of the file in the file list. Must be called before its name is changed.
 */
-void printHeader(){
-    printf("\nHEADER: \n");
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (header.fileList[i].size !=  0) {
-            printf("File name: %s \t Index:%i \t Size: %lld \t Start: %lld \t End: %lld\n", header.fileList[i].fileName,i, header.fileList[i].size, header.fileList[i].start, header.fileList[i].end);
+static void removeFromNameIndex(struct Star * star, int index){
+    if (star->header.nameIndexSize == 0) return;
+    int position = hashName(star->header.fileList[index].fileName) & (star->header.nameIndexSize - 1);
+    while (star->header.nameIndex[position] != NAME_INDEX_EMPTY){
+        if (star->header.nameIndex[position] == index){
+            star->header.nameIndex[position] = NAME_INDEX_REMOVED;
+            return;
         }
+        position = (position + 1) & (star->header.nameIndexSize - 1);
     }
-    printf("\n");
 }
 
 /*
-    Function to obtain the last file in the header list.
-    Returns the last file in the header list.
-    If there are no files, returns an empty struct.
+    Function to find a file in the header by its name, using the name index.
+    Returns the position of the file in the file list, or -1 if there is no file with that name.
+    If several files have the same name, returns the one with the lowest position.
 */
-struct File findLastFileInHeader(){
-    for (int i = MAX_FILES-1; i >= 0; i--) 
-        if (header.fileList[i].size !=  0) 
-            return header.fileList[i];
-    return header.fileList[0]; // Empty struct. There are no elements on the list.
+static int findInNameIndex(struct Star * star, const char * fileName){
+    if (star->header.nameIndexSize == 0) return -1;
+    int found = -1;
+    int position = hashName(fileName) & (star->header.nameIndexSize - 1);
+    while (star->header.nameIndex[position] != NAME_INDEX_EMPTY){
+        int index = star->header.nameIndex[position];
+        if (index >= 0 && (found == -1 || index < found) && strcmp(star->header.fileList[index].fileName, fileName) == 0)
+            found = index;
+        position = (position + 1) & (star->header.nameIndexSize - 1);
+    }
+    return found;
 }
 
-
 /*
-    Function to evaluate if a blank space node is repeated.
-    Returns 1 if repeated. Otherwise, returns 0.
+    Function to register that a position of the header changed, so its entry is written with the header.
+    Only the entries that changed are written, unless the whole index has to be written again.
+    Returns -1 if error.
 */
-int isBlankSpaceRepeated(off_t start, off_t end){
-    struct BlankSpace * actual = firstBlankSpace;
-    while (actual!=NULL){
-        if (actual->start == start && actual->end == end)
-            return 1;
-        actual=actual->nextBlankSpace;
+static int markEntryDirty(struct Star * star, int index){
+    if (star->header.fileList[index].dirty) return 0;
+    if (star->header.numDirty == star->header.dirtyCapacity){
+        int capacity = star->header.dirtyCapacity > 0 ? star->header.dirtyCapacity * 2 : MIN_INDEX_SLOTS;
+        int * dirtyEntries = (int *)realloc(star->header.dirtyEntries, capacity * sizeof(int));
+        if (dirtyEntries == NULL)
+            return setError(star, STAR_ERROR_MEMORY, "markEntryDirty: Error Malloc for the changed entries.");
+        star->header.dirtyEntries = dirtyEntries;
+        star->header.dirtyCapacity = capacity;
     }
+    star->header.dirtyEntries[star->header.numDirty++] = index;
+    star->header.fileList[index].dirty = 1;
     return 0;
 }
 
 /*
-    Function to add a blank space to BlankSpaceList.
-    The first element (firstBlankSpace) is declared at the struct definition.
-    Blank space goes from 'start' to 'end' parameters.
-    Returns 1 if added correctly.
+    Function to save a file in header.
+    CAUTION: Only saves in NULL positions of the Files array. Checks from start to finish.
+    If there are no NULL positions, the file list grows.
+    Returns the index where the file was saved, or -1 if error.
 */
-int addBlankSpace(off_t start, off_t end, int index){
-    if (isBlankSpaceRepeated(start,end)==1){
-        return 0;
-    }   
-    if (start > end) {
-        fprintf(stderr, "addBlankSpace: Error Start of blank space is higher than end.\n");
-        exit(1);
-    }
-    if (start==0 && end==0)
-        return 0;
-    
-    // Create a new node
-    struct BlankSpace * newBlankSpace = (struct BlankSpace*)malloc(sizeof(struct BlankSpace));
-    if (newBlankSpace == NULL) {
-        fprintf(stderr, "addBlankSpace: Error Malloc for new node.\n");
-        exit(1);
-    }
-    // Initialize new node of blank space;
-    newBlankSpace->start = start;
-    newBlankSpace->end = end;
-    newBlankSpace->index = index;
-    newBlankSpace->nextBlankSpace = NULL;
-
-    // Empty list or new node goes before the first one: Index lower.
-    if (firstBlankSpace == NULL || newBlankSpace->index < firstBlankSpace->index) {
-        newBlankSpace->nextBlankSpace = firstBlankSpace; // Adds node at the start of the list
-        firstBlankSpace = newBlankSpace;
-    } else { // List with elements
-        struct BlankSpace * current = firstBlankSpace;
-        
-        // Iterates while there is a next one and the index of the new node is higher or equal than current.
-        while ((current->nextBlankSpace != NULL) &&
-              (current->nextBlankSpace->index <= newBlankSpace->index)) {
-            current = current->nextBlankSpace;
-        }
-
-        newBlankSpace->nextBlankSpace = current->nextBlankSpace;
-        current->nextBlankSpace = newBlankSpace;
-    }
-    return 1;
+static int addFileToHeaderFileList(struct Star * star, struct File newFile) {
+    report(star, "Adding \"%s\" to header's file list.\n", newFile.fileName);
+    int i = 0;
+    while (i < star->header.numEntries && star->header.fileList[i].size != 0) // Empty position
+        i++;
+    char * fileName = storeName(star, newFile.fileName);
+    if (fileName == NULL || ensureHeaderCapacity(star, i + 1) == -1) return -1;
+    if (i == star->header.numEntries) // New position at the end
+        star->header.numEntries++;
+    int dirty = star->header.fileList[i].dirty; // A reused position can be in the changed entries already
+    star->header.fileList[i] = newFile;
+    star->header.fileList[i].fileName = fileName;
+    star->header.fileList[i].nameOffset = -1; // The new name goes at the end of the names table
+    star->header.fileList[i].dirty = dirty;
+    if (markEntryDirty(star, i) == -1 || addToNameIndex(star, i) == -1) return -1;
+    return i;
 }
 
 /*
-    Function to delete a blank space from the list.
-    targetIndex is the index of the blank space to be eliminated
+    Function to add a file as last in header.
+    NOT as the last of the array, but that this new file is the last in the list of files.
+    Returns -1 if error.
 */
-void deleteBlankSpace(int targetIndex) {
-    struct BlankSpace * current = firstBlankSpace;
-    struct BlankSpace * prev = NULL;
-
-    // Search for the element that matches the target index
-    while (current != NULL && current->index != targetIndex) {
-        prev = current; // Leaves pointer in the previous element.
-        current = current->nextBlankSpace; // Advances
-    }
-    
-    if (current == NULL) { // Element not found
-        printf("deleteBlankSpace: Element not found with index %d\n", targetIndex);
-        return;
-    }
-    
-    // Adjuste pointers to delete the element
-    if (prev == NULL){ // If prev is NULL, it never got in the while cycle, so current is the first element of the list.
-        firstBlankSpace = current->nextBlankSpace; // The element to be deleted is the first in the list.
-    }else{ // Not the first element.
-        prev->nextBlankSpace = current->nextBlankSpace;
-    }
-    // Free memory
-    free(current);
+static int addFileToHeaderListInLastPosition(struct Star * star, struct File newFile){
+    char * fileName = storeName(star, newFile.fileName);
+    if (fileName == NULL || ensureHeaderCapacity(star, star->header.numEntries + 1) == -1) return -1;
+    star->header.fileList[star->header.numEntries] = newFile;
+    star->header.fileList[star->header.numEntries].fileName = fileName;
+    star->header.fileList[star->header.numEntries].nameOffset = -1;
+    star->header.fileList[star->header.numEntries].dirty = 0;
+    star->header.numEntries++;
+    if (markEntryDirty(star, star->header.numEntries - 1) == -1) return -1;
+    return addToNameIndex(star, star->header.numEntries - 1);
 }
 
 /*
-    Resets and cleans completely the blank spaces list.
+    Returns the position where the content of the tar file ends: the end of the last file, of the index, of the free map,
+    of the dictionary or of the chunks.
+    New content can be written from there without overwriting anything.
 */
-void resetBlankSpaceList() {
-    struct BlankSpace * current = firstBlankSpace;
-    while (current != NULL) {
-        struct BlankSpace *next = current->nextBlankSpace;
-        free(current); // Libera la memoria del nodo actual
-        current = next;
-    }
-    firstBlankSpace = NULL; // Establish pointer to null to indicate that the list is empty.
+static off_t getEndOfContent(struct Star * star){
+    off_t endOfContent = star->header.bodyStart;
+    if (star->header.indexStart + star->header.indexCapacity > endOfContent)
+        endOfContent = star->header.indexStart + star->header.indexCapacity;
+    if (star->freeSpace.mapStart + star->freeSpace.mapCapacity > endOfContent)
+        endOfContent = star->freeSpace.mapStart + star->freeSpace.mapCapacity;
+    if (star->dictionary.start + star->dictionary.size > endOfContent)
+        endOfContent = star->dictionary.start + star->dictionary.size;
+    if (star->chunkStore.tableStart + star->chunkStore.tableCapacity > endOfContent)
+        endOfContent = star->chunkStore.tableStart + star->chunkStore.tableCapacity;
+    if (star->chunkStore.end > endOfContent)
+        endOfContent = star->chunkStore.end;
+    for (int i = 0; i < star->header.numEntries; i++)
+        if (star->header.fileList[i].size != 0 && star->header.fileList[i].end > endOfContent)
+            endOfContent = star->header.fileList[i].end;
+    return endOfContent;
 }
 
 /*
-    Function to print the current blank spaces.
+    Function to place the index at 'start'.
+    numFiles and namesSize are the amount of files and bytes of names that the index must hold.
+    Some extra space is reserved so the next files can be added without moving the index.
+    The end of the index is rounded up to BODY_ALIGNMENT, so the content after it is aligned.
 */
-void printBlankSpaces(){
-    printf("\nBLANK SPACES: \n");
-    struct BlankSpace * current = firstBlankSpace;
-    if (current==NULL){
-        printf("There are no blank spaces\n");
-        return;
-    }
-    while (current != NULL) {
-        printf("BlankSpace ->\tStart: %lld\tEnd: %lld\n", current->start, current->end);
-        current = current->nextBlankSpace;
-    }
-    printf("\n");
+static void placeIndex(struct Star * star, off_t start, int numFiles, off_t namesSize){
+    int slots = numFiles + numFiles / 2;
+    if (slots < MIN_INDEX_SLOTS) slots = MIN_INDEX_SLOTS;
+    off_t namesCapacity = namesSize + namesSize / 2;
+    if (namesCapacity < MIN_NAMES_CAPACITY) namesCapacity = MIN_NAMES_CAPACITY;
 
+    off_t end = start + (off_t)slots * sizeof(struct IndexEntry) + namesCapacity;
+    end = (end + BODY_ALIGNMENT - 1) / BODY_ALIGNMENT * BODY_ALIGNMENT; // Rounds up
+    star->header.indexStart = start;
+    star->header.slotCapacity = slots;
+    star->header.indexCapacity = end - start; // The rounding is used for names
 }
 
-/*  
-    Function to write the header in the tar file.
-    tarFile is the indiciator of the tar file. Must be opened in writing mode.
+/*
+    Function to reserve the index at the start of the tar file, right after the superblock.
+    The content of the files starts after the index (bodyStart).
 */
-void writeHeaderToTar(int tarFile){
-    printf("Writing header to tar...\n");
-    char headerBlock[sizeof(header)]; // Block to be written on tar file
-    memset(headerBlock, 0, sizeof(headerBlock));  // Empty assurance
-    memcpy(headerBlock, &header, sizeof(header)); // Copies content from header on the headerBlock
-    if (write(tarFile, headerBlock, sizeof(headerBlock)) != sizeof(headerBlock)){ // Writes headerBlock in tar file
-        perror("writeHeaderToTar: Error writing header in tar file.");
-        exit(1);
-    }
+static void placeIndexAtStart(struct Star * star, int numFiles, off_t namesSize){
+    placeIndex(star, SUPERBLOCK_SIZE, numFiles, namesSize);
+    star->header.bodyStart = star->header.indexStart + star->header.indexCapacity;
 }
 
 /*
-    Function to write the content of a file in the tar file.
-    tarFileName is the name of the tar file.
-    fileName is the name of the file which its content will be recorded on the tar file body.
-*/
-void writeFileContentToTar(const char * tarFileName,const char * fileName){
-    int file = openFile(fileName,0);
-    struct File fileInfo = findFile(tarFileName,fileName); // Finds file in the header
-    if (fileInfo.size==0){
-        printf("writeFileContentToTar: File not found in tar file.\n");
-        exit(11);
-    }
-    char buffer[fileInfo.size]; // Buffer to save the content of the file
-    read(file,buffer, sizeof(buffer)); // Reads content and saves it of buffer
-    int tarFile = openFile(tarFileName,0);
-    lseek(tarFile, fileInfo.start, SEEK_SET); // Sets pointer to the start position for the file
-
-    if (write(tarFile, buffer, sizeof(buffer)) == -1) { // Writes
-        perror("writeFileContentToTar: Error writing on tar file.");
-        close(tarFile);
-        exit(1);
-    }
-    // Close both files
-    close(file);
-    close(tarFile);
+    Returns the bytes needed to store the names of all the positions of the header, with their '\0'.
+*/
+static off_t getNamesSize(struct Star * star){
+    off_t namesSize = 0;
+    for (int i = 0; i < star->header.numEntries; i++)
+        namesSize += (star->header.fileList[i].fileName != NULL ? strlen(star->header.fileList[i].fileName) : 0) + 1;
+    return namesSize;
 }
 
 /*
-    Function to write the content of the files stored in header into the tar files.
-    tarFileName is the name of the tar file.
-    fileNames is an array with the names of all the files to be written.
-    numFiles is the ammount of files to be written.
+    Function to count a system call that moved 'bytes' bytes, for starStats. kind is IO_*.
+    The threads of an operation count at the same time, so the counters are atomic.
 */
-void writeBodyToTar(const char * tarFileName,const char * fileNames[],int numFiles){
-    printf("Writing body to tar...\n");
-    for (int i=0;i<numFiles;i++){
-        struct stat fileStat;
-        if (lstat(fileNames[i], &fileStat) == -1) { // Extracts file info and saves it on fileStat
-            perror("writeBodyToTar: Error getting file info.");
-            exit(1);
-        }else
-            writeFileContentToTar(tarFileName,fileNames[i]);
-    }
+static void countCall(struct Star * star, int kind, ssize_t bytes){
+    struct StarStats * stats = &star->stats;
+    uint64_t moved = bytes > 0 ? (uint64_t)bytes : 0;
+    if (kind == IO_READ) __atomic_fetch_add(&stats->readCalls, 1, __ATOMIC_RELAXED);
+    else if (kind == IO_WRITE) __atomic_fetch_add(&stats->writeCalls, 1, __ATOMIC_RELAXED);
+    else if (kind == IO_COPY) __atomic_fetch_add(&stats->copyCalls, 1, __ATOMIC_RELAXED);
+    if (kind != IO_WRITE) __atomic_fetch_add(&stats->bytesRead, moved, __ATOMIC_RELAXED);
+    if (kind != IO_READ && kind != IO_MAPPED) __atomic_fetch_add(&stats->bytesWritten, moved, __ATOMIC_RELAXED);
 }
 
 /*
-    Function in charge of writing the body of tar file.
-    tarFileName is the name of the tar file.
-    fileNames is an array with the names of all the files to be written.
-    numFiles is the ammount of files to be written.
+    Function to read exactly 'size' bytes from a file starting at 'position'.
+    Retries partial reads and interrupted calls. Does not move the file pointer.
+    Returns the amount of bytes read, which is lower than 'size' only if the end of file was reached.
+    Returns -1 if error.
 */
-void createBody(const char * tarFileName, const char *fileNames[],int numFiles){
-    int tarFile = openFile(tarFileName,0);
-    if (readHeaderFromTar(tarFile)==1){ // Read the content in header to be up to date.
-        close(tarFile);
-        writeBodyToTar(tarFileName, fileNames,numFiles);
-    }else{
-        printf("createBody: Error reading header.\n");
-        close(tarFile);
-        exit(10);
+static ssize_t readFully(struct Star * star, int file, void * buffer, size_t size, off_t position){
+    size_t totalRead = 0;
+    while (totalRead < size){
+        ssize_t bytesRead = pread(file, (char *)buffer + totalRead, size - totalRead, position + totalRead);
+        countCall(star, IO_READ, bytesRead);
+        if (bytesRead == -1){
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytesRead == 0) break; // End of file
+        totalRead += bytesRead;
     }
-    close(tarFile);
+    return totalRead;
 }
 
 /*
-    Function to create the tar file header.
-    numFiles is the ammount of files to be written.
-    tarFile is the file tar that will be created.
-    fileNames is an array with the names of all the files to be packaged.
+    Function to read exactly 'size' bytes from a file that can only be read in order, like a pipe.
+    Retries partial reads and interrupted calls.
+    Returns the amount of bytes read, which is lower than 'size' only if the end of file was reached.
+    Returns -1 if error.
 */
-void createHeader(int numFiles,int tarFile, const char * fileNames[]){
-    printf("\nCREATE HEADER\n");
-    const char * fileName;
-    struct stat fileStat; // File info
-    struct File newFile; // File to be added
-    for (int i=0; i < numFiles; i++){
-        fileName = fileNames[i];
-        if (lstat(fileName, &fileStat) == -1) { // Extracts file info and saves it on fileStat
-            perror("createHeader: Error getting file info.");
-            close(tarFile);
-            exit(1);
-        }
-        // Copy file info to struct
-        strncpy(newFile.fileName, fileName, MAX_FILENAME_LENGTH);
-        newFile.size = fileStat.st_size;
-        newFile.mode = fileStat.st_mode;
-        newFile.deleted = 0;
-        if (currentPosition==0) // First file
-            newFile.start = currentPosition = sizeof(header)+1;
-        else 
-            newFile.start = currentPosition;
-        newFile.end = currentPosition = newFile.start + fileStat.st_size;
-        addFileToHeaderFileList(newFile); // Update header
+static ssize_t readStream(struct Star * star, int file, void * buffer, size_t size){
+    size_t totalRead = 0;
+    while (totalRead < size){
+        ssize_t bytesRead = read(file, (char *)buffer + totalRead, size - totalRead);
+        countCall(star, IO_READ, bytesRead);
+        if (bytesRead == -1){
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytesRead == 0) break; // End of file
+        totalRead += bytesRead;
     }
-    writeHeaderToTar(tarFile); // Writes header on tar file
-    close(tarFile);
+    return totalRead;
 }
 
 /*
-    Function to calculate the blank spaces between the files in the tar file.
-    lastFile is the last existent file in the tar file.
-    sizeOfTar is the size of the whole tar file.
-    tarFileName is the name of the tar file.
+    Function to write exactly 'size' bytes in a file starting at 'position'.
+    Retries partial writes and interrupted calls. Does not move the file pointer.
+    The standard output (streamOutput) can be a pipe, so it is written in order and 'position' is not used:
+    its content is always written from the start to the end, by one thread.
+    Returns the amount of bytes written or -1 if error.
 */
-void calculateSpaceBetweenFilesAux(struct File lastFile, off_t sizeOfTar, const char * tarFileName){
-    struct File nextFile;
-    int indexLastFile = findIndexFile(tarFileName,lastFile.fileName);
-    for (int i = 0; i < MAX_FILES ; i++ ){
-        if (header.fileList[i].deleted == 1){ // This position has been already deleted
-            if (i != MAX_FILES-1 && i != 0 ){ // Not the last nor the first file
-                if (header.fileList[i+1].start != 0){
-                    addBlankSpace(header.fileList[i-1].end, header.fileList[i+1].start, i);
-                } else{ // There are not more files
-                    addBlankSpace(header.fileList[i-1].end, sizeOfTar-1, i);
-                }
-            }else if (i==0){ // First file
-                addBlankSpace(sizeof(header) + 1 ,header.fileList[i+1].start, 0);
-            }
-        }else{
-            if (i < MAX_FILES-1 && (header.fileList[i+1].size>0) && (header.fileList[i].end != header.fileList[i+1].start)){ // Not the last
-                addBlankSpace(header.fileList[i].end, header.fileList[i+1].start, i);
-            }
+static ssize_t writeFully(struct Star * star, int file, const void * buffer, size_t size, off_t position){
+    size_t totalWritten = 0;
+    while (totalWritten < size){
+        ssize_t bytesWritten = file == star->streamOutput ? write(file, (const char *)buffer + totalWritten, size - totalWritten) :
+                               pwrite(file, (const char *)buffer + totalWritten, size - totalWritten, position + totalWritten);
+        countCall(star, IO_WRITE, bytesWritten);
+        if (bytesWritten == -1){
+            if (errno == EINTR) continue;
+            return -1;
         }
+        totalWritten += bytesWritten;
     }
+    return totalWritten;
 }
 
 /*
-    Function called to calculate the blank spaces.
-    Prints blank spaces when done.
+    Function to prepare the calculation of the CRC32C: the tables used without the crc32 instruction,
+    and whether the processor has it. Called once, before any thread calculates a checksum.
 */
-void calculateBlankSpaces(const char * tarFileName){
-    printf("Calculating blank spaces...\n");
-    off_t sizeOfTar = getFileSize(tarFileName);// Obtiene el tamaño del archivo tar.
-    int tarFile = openFile(tarFileName, 0);// Abre el archivo para leer el header.
-
-    if (readHeaderFromTar(tarFile) != 1){
-        printf("calculateBlankSpaces: Error reading header from tar file.\n");
-        close(tarFile);
-        exit(10);
+static void initChecksum(){
+    for (int i = 0; i < 256; i++){
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        crc32cTable[0][i] = crc;
     }
-    close(tarFile);
-    calculateSpaceBetweenFilesAux(findLastFileInHeader(),sizeOfTar,tarFileName);
-    printBlankSpaces();
+    for (int i = 0; i < 256; i++) // Each table is the previous one one byte further
+        for (int table = 1; table < 8; table++)
+            crc32cTable[table][i] = (crc32cTable[table - 1][i] >> 8) ^ crc32cTable[0][crc32cTable[table - 1][i] & 0xFF];
+#if defined(__x86_64__) || defined(__i386__)
+    crc32cInstruction = __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crc32cInstruction = 1;
+#endif
 }
 
+#if defined(__x86_64__) || defined(__i386__)
 /*
-    Functino that creates a tar file with the selected files.
-    fileNames is an array with all the files to be added in the tar file.
-    tarFileName is the name of the tar file.
-    numFiles is the ammount of files that will be created.
+    CRC32C with the crc32 instruction of SSE4.2, 8 bytes at a time (4 in 32 bits).
+    crc is the internal value, without the final inversion.
+*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32cInstructionBlock(uint32_t crc, const unsigned char * data, size_t size){
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), data += sizeof(uint64_t)){
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; size >= sizeof(uint32_t); size -= sizeof(uint32_t), data += sizeof(uint32_t)){
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; size > 0; size--, data++)
+        crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/*
+    CRC32C with the crc32c instructions of ARMv8, 8 bytes at a time.
+    crc is the internal value, without the final inversion.
 */
-void createStar(int numFiles, const char *tarFileName, const char *fileNames[]){
-    printf("\nCREATE TAR FILE\n");
-    printf("Size of header: %ld\n",sizeof(header));
-    if (numFiles > MAX_FILES){
-        printf("createStar: The maximum number of files has been exceeded.\n");
-        exit(1);
+static uint32_t crc32cInstructionBlock(uint32_t crc, const unsigned char * data, size_t size){
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), data += sizeof(uint64_t)){
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
     }
-    createHeader(numFiles,openFile(tarFileName,1),fileNames);
-    printHeader();
-    createBody(tarFileName,fileNames,numFiles);
+    for (; size > 0; size--, data++)
+        crc = __crc32cb(crc, *data);
+    return crc;
 }
+#endif
 
 /*
-    Function to delete a file from header.
-    file is the file to be deleted.
-    Returns 1 if deleted successfully.
+    Returns the CRC32C of 'data' continuing the one of the previous bytes, 'checksum' (0 for the first bytes).
+    Uses the crc32 instruction if the processor has it, otherwise the tables, 8 bytes at a time.
 */
-int deleteFileFromHeader(struct File file){
-    printf("Deleting file from header...\n");
-    for (int i=0;i<MAX_FILES;i++){
-        if (strcmp(header.fileList[i].fileName,file.fileName)==0){
-            header.fileList[i].size=0;
-            header.fileList[i].deleted=1; // Used to not mix the blank spaces
-            numFiles--;
-            return 1;
-        }
+static uint32_t updateChecksum(uint32_t checksum, const void * data, size_t size){
+    const unsigned char * bytes = (const unsigned char *)data;
+    uint32_t crc = ~checksum;
+#if defined(__x86_64__) || defined(__i386__) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+    if (crc32cInstruction)
+        return ~crc32cInstructionBlock(crc, bytes, size);
+#endif
+    for (; size >= 8; size -= 8, bytes += 8){ // Little endian
+        uint32_t low = crc ^ (bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+        crc = crc32cTable[7][low & 0xFF] ^ crc32cTable[6][(low >> 8) & 0xFF] ^
+              crc32cTable[5][(low >> 16) & 0xFF] ^ crc32cTable[4][low >> 24] ^
+              crc32cTable[3][bytes[4]] ^ crc32cTable[2][bytes[5]] ^ crc32cTable[1][bytes[6]] ^ crc32cTable[0][bytes[7]];
     }
-    return 0;
+    for (; size > 0; size--, bytes++)
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *bytes) & 0xFF];
+    return ~crc;
 }
 
 /*
-    Function to eliminate the content of a file from the body of the tar file.
-    tarFileName is the name of the tar file.
-    fileToBeDeleted is the file to be deleted.
-    DOES NOT modify the size of the tar file.
+    Function to copy content between two files without passing it through user space.
+    First tries copy_file_range, which can even share the blocks on filesystems that support it.
+    If the kernel refuses it (different filesystems, old kernel...), moves the content with splice through a pipe.
+    sendfile is not used because it writes at the current position of the destination file.
+    Both ways use explicit positions, so the file pointers are not moved.
+    Returns the amount of bytes copied. It can be lower than 'length' if the kernel could not copy everything;
+    the rest must be copied with the buffer.
 */
-void deleteFileContentFromBody(const char* tarFileName,struct File fileToBeDeleted) {
-    printf("Deleting file from body...\n");
-    FILE * tarFile = fopen(tarFileName, "r+");
-    if (tarFile == NULL) {
-        perror("deleteFileContentFromBody: Error opening file.");
-        exit(1);
+static off_t kernelCopyContent(struct Star * star, int fromFile, off_t fromPosition, int toFile, off_t toPosition, off_t length){
+    off_t copied = 0;
+#ifdef __linux__
+    while (copied < length){ // copy_file_range
+        loff_t fromOffset = fromPosition + copied;
+        loff_t toOffset = toPosition + copied;
+        ssize_t bytesCopied = copy_file_range(fromFile, &fromOffset, toFile, &toOffset, length - copied, 0);
+        countCall(star, IO_COPY, bytesCopied);
+        if (bytesCopied == -1 && errno == EINTR) continue;
+        if (bytesCopied <= 0) break; // Not supported for these files or end of file
+        copied += bytesCopied;
     }
-    fseek(tarFile, 0, SEEK_END);
-    char buffer[1028]; // Default writing size
-    fseek(tarFile, fileToBeDeleted.start, SEEK_SET); // Moves pointer to the start of the range
+    if (copied == length) return copied;
 
-    // Fills the range with null characters
-    size_t rangeSize = fileToBeDeleted.end - fileToBeDeleted.start + 1;
-    memset(buffer, 0, sizeof(buffer));
-    
-    // Makes sure to delete all the content although the size of the buffer
-    while (rangeSize > 0) {
-        size_t bytesToWrite = rangeSize < sizeof(buffer) ? rangeSize : sizeof(buffer);
-        fwrite(buffer, 1, bytesToWrite, tarFile);
-        rangeSize -= bytesToWrite;
+    int pipeEnds[2]; // splice needs a pipe between both files
+    if (pipe(pipeEnds) == -1) return copied;
+    while (copied < length){
+        loff_t fromOffset = fromPosition + copied;
+        size_t blockSize = (length - copied) < COPY_BUFFER_SIZE ? (size_t)(length - copied) : COPY_BUFFER_SIZE;
+        ssize_t inPipe = splice(fromFile, &fromOffset, pipeEnds[1], NULL, blockSize, SPLICE_F_MOVE);
+        countCall(star, IO_COPY, 0); // The bytes are counted when they leave the pipe
+        if (inPipe == -1 && errno == EINTR) continue;
+        if (inPipe <= 0) break;
+        while (inPipe > 0){ // Empties the pipe in the destination file
+            loff_t toOffset = toPosition + copied;
+            ssize_t bytesCopied = splice(pipeEnds[0], NULL, toFile, &toOffset, inPipe, SPLICE_F_MOVE);
+            countCall(star, IO_COPY, bytesCopied);
+            if (bytesCopied == -1 && errno == EINTR) continue;
+            if (bytesCopied <= 0){ // What is left in the pipe is discarded and copied again with the buffer
+                close(pipeEnds[0]);
+                close(pipeEnds[1]);
+                return copied;
+            }
+            copied += bytesCopied;
+            inPipe -= bytesCopied;
+        }
     }
-    fseek(tarFile, 0, SEEK_END);
-    fclose(tarFile);
+    close(pipeEnds[0]);
+    close(pipeEnds[1]);
+#endif
+    return copied;
 }
 
 /*
-    Function in charge to delete a file from the tar file.
-    tarFileName is the name of the tar file.
-    fileNameTobeDeleted is the name of the file to be deleted.
-    Returns 0 if successfully.
-*/
-int deleteFile(const char * tarFileName,const char * fileNameTobeDeleted){
-    printf("\nDELETE FILE\n");
-    int tarFile = openFile(tarFileName,0);
-    struct File fileTobeDeleated = findFile(tarFileName,fileNameTobeDeleted);
-    if (fileTobeDeleated.size==0){
-        printf("deleteFile: File not found in the tar file.\n");
-        exit(11);
-    }
-    printf("File to be deleted: %s\tStart:%lld\tEnd: %lld\n",fileNameTobeDeleted,fileTobeDeleated.start,fileTobeDeleated.end);
-
-    deleteFileContentFromBody(tarFileName,fileTobeDeleated); // Deletes file from body of tar file.
-    deleteFileFromHeader(fileTobeDeleated); // Deletes file from header.
-    writeHeaderToTar(tarFile); // Re-writes header to tar
-    close(tarFile);
-    calculateBlankSpaces(tarFileName); // Re-calculate blank spaces.
+    Function to copy 'length' bytes from one file to another.
+    Unless transferMode is TRANSFER_BUFFERED, the kernel copies as much as it can first (kernelCopyContent).
+    The rest is moved in blocks through a fixed size buffer, so the memory used does not depend on 'length'.
+    If checksum is not NULL, it gets the CRC32C of the content. Then the whole content goes through the buffer,
+    and the checksum of each block is calculated while it is in the cache, between the read and the write.
+    fromFile and fromPosition indicate where the content is read.
+    toFile and toPosition indicate where the content is written.
+    Returns 0 if copied correctly, -1 if error.
+*/
+static int copyContentWithChecksum(struct Star * star, int fromFile, off_t fromPosition, int toFile, off_t toPosition, off_t length, uint32_t * checksum){
+    char buffer[COPY_BUFFER_SIZE]; // Reused for every block
+    off_t copied = 0;
+    if (checksum != NULL)
+        *checksum = 0;
+    else if (star->options.transferMode == STAR_TRANSFER_AUTO && toFile != star->streamOutput) // The standard output is written in order
+        copied = kernelCopyContent(star, fromFile, fromPosition, toFile, toPosition, length);
+    while (copied < length){
+        size_t blockSize = (length - copied) < COPY_BUFFER_SIZE ? (size_t)(length - copied) : COPY_BUFFER_SIZE;
+        ssize_t bytesRead = readFully(star, fromFile, buffer, blockSize, fromPosition + copied);
+        if (bytesRead == -1)
+            return setError(star, STAR_ERROR_IO, "copyContent: Error reading content: %s.", strerror(errno));
+        if ((size_t)bytesRead < blockSize)
+            return setError(star, STAR_ERROR_IO, "copyContent: Unexpected end of file while reading content.");
+        if (checksum != NULL)
+            *checksum = updateChecksum(*checksum, buffer, blockSize);
+        if (writeFully(star, toFile, buffer, blockSize, toPosition + copied) == -1)
+            return setError(star, STAR_ERROR_IO, "copyContent: Error writing content: %s.", strerror(errno));
+        copied += blockSize;
+    }
     return 0;
 }
 
-
 /*
-    Function to list the contents inside the tar file.
-    tarFileName is the name of the tar file.
+    Function to copy 'length' bytes from one file to another (copyContentWithChecksum), without checksum.
+    Returns 0 if copied correctly, -1 if error.
+*/
+static int copyContent(struct Star * star, int fromFile, off_t fromPosition, int toFile, off_t toPosition, off_t length){
+    return copyContentWithChecksum(star, fromFile, fromPosition, toFile, toPosition, length, NULL);
+}
+
+/*
+    Returns the current time in seconds. Used to measure the duration of the operations.
+*/
+static double currentSeconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+    Function to add the time since startTime to a phase (STAR_PHASE_*) of starStats.
+*/
+static void addPhaseTime(struct Star * star, int phase, double startTime){
+    star->stats.phaseSeconds[phase] += currentSeconds() - startTime;
+}
+
+/*
+    Shared state of the threads of runInParallel.
+    Each thread takes the next job that nobody has taken yet.
+*/
+struct ParallelWork {
+    int numJobs;
+    int nextJob;
+    int failed; // 1 if a job failed. The jobs that were not taken yet are not run
+    pthread_mutex_t lock;
+    int (*job)(int index, void * context);
+    void * context;
+};
+
+/*
+    Function executed by every thread of runInParallel. Runs jobs until there are no more, or one fails.
+*/
+static void * parallelWorker(void * argument){
+    struct ParallelWork * work = (struct ParallelWork *)argument;
+    while (1){
+        pthread_mutex_lock(&work->lock);
+        int index = work->failed ? work->numJobs : work->nextJob++;
+        pthread_mutex_unlock(&work->lock);
+        if (index >= work->numJobs) break;
+        if (work->job(index, work->context) == -1){
+            pthread_mutex_lock(&work->lock);
+            work->failed = 1;
+            pthread_mutex_unlock(&work->lock);
+        }
+    }
+    return NULL;
+}
+
+/*
+    Function to run 'numJobs' jobs with 'threads' threads.
+    job is called once for every index from 0 to numJobs-1, with the received context.
+    A job returns -1 if it failed, after registering the error in the handle. Then no more jobs are started.
+    If threads is 1 or lower, the jobs run in order in the calling thread.
+    Returns when all the started jobs are done: 0, or -1 if a job failed.
+*/
+static int runInParallel(struct Star * star, int numJobs, int threads, int (*job)(int index, void * context), void * context){
+    if (threads > numJobs) threads = numJobs;
+    if (threads <= 1){
+        for (int i = 0; i < numJobs; i++)
+            if (job(i, context) == -1) return -1;
+        return 0;
+    }
+    struct ParallelWork work = {numJobs, 0, 0, PTHREAD_MUTEX_INITIALIZER, job, context};
+    pthread_t * workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if (workers == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "runInParallel: Error Malloc for threads.");
+    int created = 0;
+    for (; created < threads; created++){
+        if (pthread_create(&workers[created], NULL, parallelWorker, &work) != 0)
+            break; // The threads already created do all the work
+    }
+    if (created == 0) parallelWorker(&work);
+    for (int i = 0; i < created; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    return work.failed ? -1 : 0;
+}
+
+/*
+    Submission and completion queues of io_uring, used without liburing through the system calls (--uring).
+    The kernel shares them with the process in three mappings.
+*/
+struct Ring {
+    int fd; // -1 if io_uring is not available
+    unsigned * sqHead;
+    unsigned * sqTail;
+    unsigned sqMask;
+    unsigned * sqArray;
+    unsigned sqEntries;
+    unsigned * cqHead;
+    unsigned * cqTail;
+    unsigned cqMask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+    void * sqMap;
+    size_t sqMapSize;
+    void * cqMap;
+    size_t cqMapSize;
+    unsigned prepared; // Entries added to the submission queue and not submitted yet
+    uint64_t calls; // io_uring_enter made, for starStats
+};
+
+/*
+    Member moved in a batch, by io_uring or by vectored system calls: 'size' bytes from 'fromPosition' of one file
+    to 'toPosition' of the other. One of them is the tar file, and the other one is opened by the engine with its name.
+*/
+struct MemberTransfer {
+    const char * fileName;
+    int fromNamed; // 1 if the content is read from the named file (-c, -r), 0 if it is written to it (-x)
+    off_t fromPosition;
+    off_t toPosition;
+    off_t size;
+    int job; // Position of the member in the operation
+    int file; // Named file opened by io_uring. -1 if it is not opened
+    char * buffer; // Where the content is read, and written from
+    int moved; // Steps that moved all the bytes (RING_READ, RING_WRITE). RING_MOVED if it is done, otherwise it is left for the usual path
+    uint32_t checksum; // CRC32C of the content, when it is done
+};
+
+#ifdef URING_AVAILABLE
+/*
+    Function to create a ring with space for 'entries' operations.
+    Returns -1 if io_uring is not available (old kernel, or forbidden), and then the files are moved with system calls.
+*/
+static int openRing(struct Ring * ring, unsigned entries){
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0){
+        ring->fd = -1;
+        return -1;
+    }
+    ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED || ring->sqes == MAP_FAILED){
+        if (ring->sqMap != MAP_FAILED) munmap(ring->sqMap, ring->sqMapSize);
+        if (ring->cqMap != MAP_FAILED) munmap(ring->cqMap, ring->cqMapSize);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+    char * sq = (char *)ring->sqMap;
+    char * cq = (char *)ring->cqMap;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/*
+    Function to free the ring.
+*/
+static void closeRing(struct Ring * ring){
+    if (ring->fd == -1) return;
+    munmap(ring->sqes, ring->sqEntries * sizeof(struct io_uring_sqe));
+    munmap(ring->sqMap, ring->sqMapSize);
+    munmap(ring->cqMap, ring->cqMapSize);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/*
+    Function to add an operation to the submission queue. It is sent to the kernel by submitRing.
+    The queue must have space: the engine never prepares more than the entries of the ring between two submits.
+    opcode is IORING_OP_*, and userData identifies its completion.
+*/
+static struct io_uring_sqe * prepareRing(struct Ring * ring, int opcode, int file, const void * address, unsigned length, off_t position, uint64_t userData){
+    unsigned tail = *ring->sqTail + ring->prepared++;
+    struct io_uring_sqe * sqe = &ring->sqes[tail & ring->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = file;
+    sqe->addr = (uint64_t)(uintptr_t)address;
+    sqe->len = length;
+    sqe->off = (uint64_t)position;
+    sqe->user_data = userData;
+    ring->sqArray[tail & ring->sqMask] = tail & ring->sqMask;
+    return sqe;
+}
+
+/*
+    Function to submit the prepared operations and wait until all of them are completed, with one io_uring_enter
+    if the kernel takes all of them at once. complete is called with the userData and the result (like the one of the system call, or -errno) of each one.
+    Returns -1 if they can not be submitted.
+*/
+static int submitRing(struct Ring * ring, void (*complete)(uint64_t userData, int result, void * context), void * context){
+    unsigned toComplete = ring->prepared;
+    __atomic_store_n(ring->sqTail, *ring->sqTail + ring->prepared, __ATOMIC_RELEASE);
+    unsigned toSubmit = ring->prepared;
+    ring->prepared = 0;
+    while (toComplete > 0){
+        // The kernel only waits if it took every submission, so waiting for all of them can not block forever
+        int submitted = (int)syscall(__NR_io_uring_enter, ring->fd, toSubmit, toComplete, IORING_ENTER_GETEVENTS, NULL, 0);
+        ring->calls++;
+        if (submitted < 0 && errno == EINTR) continue;
+        if (submitted < 0) return -1;
+        toSubmit -= (unsigned)submitted < toSubmit ? (unsigned)submitted : toSubmit;
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail && toComplete > 0; head++, toComplete--){
+            struct io_uring_cqe * cqe = &ring->cqes[head & ring->cqMask];
+            complete(cqe->user_data, cqe->res, context);
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/*
+    Completion of an operation of runRingTransfers. userData is the position of the member in the batch, by 4, plus the step.
+    context is the batch.
+*/
+static void completeTransfer(uint64_t userData, int result, void * context){
+    struct MemberTransfer * transfer = &((struct MemberTransfer *)context)[userData / 4];
+    int step = (int)(userData % 4);
+    if (step == RING_OPEN)
+        transfer->file = result >= 0 ? result : -1;
+    else if ((step == RING_READ || step == RING_WRITE) && result == transfer->size) // All the bytes
+        transfer->moved |= step;
+}
+
+/*
+    Function to move small members with io_uring, RING_BATCH at a time. Every batch takes three submits instead of five
+    system calls per member: the named files are opened, then every member is read to its buffer and written
+    (the write is linked to the read, so it starts when the read ends), and then the named files are closed.
+    The checksum of the members moved is calculated from their buffers.
+    Members that can not be moved are left for the usual path, which moves them again and reports the error, if any.
+    If io_uring is not available, nothing is moved.
+*/
+static void runRingTransfers(struct Star * star, int tarFile, struct MemberTransfer * transfers, int numTransfers){
+    for (int i = 0; i < numTransfers; i++)
+        transfers[i].moved = 0;
+    struct Ring ring;
+    if (numTransfers == 0) return;
+    if (openRing(&ring, RING_ENTRIES) == -1){
+        report(star, "io_uring is not available, the files are moved with system calls.\n");
+        return;
+    }
+    char * buffers = (char *)malloc((size_t)RING_BATCH * SMALL_MEMBER_LIMIT);
+    int failed = buffers == NULL;
+    for (int first = 0; first < numTransfers && !failed; first += RING_BATCH){
+        struct MemberTransfer * batch = transfers + first;
+        int amount = numTransfers - first < RING_BATCH ? numTransfers - first : RING_BATCH;
+        for (int i = 0; i < amount; i++){
+            batch[i].file = -1;
+            batch[i].buffer = buffers + (size_t)i * SMALL_MEMBER_LIMIT;
+            struct io_uring_sqe * sqe = prepareRing(&ring, IORING_OP_OPENAT, AT_FDCWD, batch[i].fileName, 0666, 0, (uint64_t)i * 4 + RING_OPEN);
+            sqe->open_flags = batch[i].fromNamed ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC; // Like openFile with option 1
+        }
+        failed = submitRing(&ring, completeTransfer, batch) == -1;
+        for (int i = 0; i < amount && !failed; i++){
+            if (batch[i].file == -1) continue;
+            int fromFile = batch[i].fromNamed ? batch[i].file : tarFile;
+            int toFile = batch[i].fromNamed ? tarFile : batch[i].file;
+            struct io_uring_sqe * sqe = prepareRing(&ring, IORING_OP_READ, fromFile, batch[i].buffer, batch[i].size, batch[i].fromPosition,
+                                                    (uint64_t)i * 4 + RING_READ);
+            sqe->flags |= IOSQE_IO_LINK; // If the read fails, the write is canceled
+            prepareRing(&ring, IORING_OP_WRITE, toFile, batch[i].buffer, batch[i].size, batch[i].toPosition, (uint64_t)i * 4 + RING_WRITE);
+        }
+        if (!failed) failed = submitRing(&ring, completeTransfer, batch) == -1;
+        for (int i = 0; i < amount; i++){
+            if (batch[i].file == -1) continue;
+            if (failed) close(batch[i].file); // The ring does not work, the rest is done by the usual path
+            else prepareRing(&ring, IORING_OP_CLOSE, batch[i].file, NULL, 0, 0, (uint64_t)i * 4 + RING_CLOSE);
+        }
+        if (!failed) failed = submitRing(&ring, completeTransfer, batch) == -1;
+        for (int i = 0; i < amount; i++){
+            if (failed) batch[i].moved = 0;
+            if (batch[i].moved == RING_MOVED){
+                batch[i].checksum = updateChecksum(0, batch[i].buffer, batch[i].size);
+                star->stats.bytesRead += batch[i].size;
+                star->stats.bytesWritten += batch[i].size;
+            }
+        }
+    }
+    star->stats.ringCalls += ring.calls;
+    free(buffers);
+    closeRing(&ring);
+}
+#else
+static void runRingTransfers(struct Star * star, int tarFile, struct MemberTransfer * transfers, int numTransfers){
+    for (int i = 0; i < numTransfers; i++)
+        transfers[i].moved = 0;
+    if (numTransfers > 0) report(star, "io_uring is not available, the files are moved with system calls.\n");
+}
+#endif
+
+/*
+    Adjacent members of the tar file moved by one preadv or pwritev (a job of runVectoredTransfers).
+*/
+struct VectorRun {
+    int first; // Position of its first member in the sorted transfers
+    int count;
+    off_t start; // Range of the tar file, with the gaps between the members when they are read
+    off_t end;
+};
+
+/*
+    Information shared by the threads that move the runs of runVectoredTransfers.
+*/
+struct VectorWork {
+    struct Star * star;
+    int tarFile;
+    struct MemberTransfer * transfers; // Sorted by their position in the tar file
+    struct VectorRun * runs;
+};
+
+/*
+    Function to obtain the position in the tar file of a member moved in a batch.
+*/
+static off_t getTarPosition(const struct MemberTransfer * transfer){
+    return transfer->fromNamed ? transfer->toPosition : transfer->fromPosition;
+}
+
+/*
+    Function to compare members by their position in the tar file, to sort them with qsort.
+*/
+static int compareTransfersByPosition(const void * a, const void * b){
+    off_t first = getTarPosition((const struct MemberTransfer *)a), second = getTarPosition((const struct MemberTransfer *)b);
+    return (first > second) - (first < second);
+}
+
+/*
+    Function that moves one run of adjacent members. Job of runInParallel used by runVectoredTransfers.
+    The members are read to their buffers, inside one allocation, and then written:
+    when they are extracted, the whole run comes from the tar file with one preadv and every member goes to its own file;
+    when they are added, every member comes from its own file and the whole run goes to the tar file with one pwritev.
+    The gaps of a run (only when it is read) are read to a scratch buffer that is not used.
+    A member that fails is not done and is left for the usual path. Always returns 0.
+*/
+static int moveRunJob(int index, void * context){
+    struct VectorWork * work = (struct VectorWork *)context;
+    struct VectorRun * run = &work->runs[index];
+    struct MemberTransfer * members = work->transfers + run->first;
+    int extracting = !members[0].fromNamed;
+    char * buffer = (char *)malloc(run->end - run->start);
+    struct iovec * vectors = (struct iovec *)malloc(2 * run->count * sizeof(struct iovec)); // A member and the gap before it
+    char gap[VECTOR_GAP_LIMIT];
+    int numVectors = 0;
+    off_t position = run->start;
+    for (int i = 0; buffer != NULL && vectors != NULL && i < run->count; i++){
+        off_t memberStart = getTarPosition(&members[i]);
+        if (memberStart > position){
+            vectors[numVectors].iov_base = gap;
+            vectors[numVectors++].iov_len = memberStart - position;
+        }
+        members[i].buffer = buffer + (memberStart - run->start);
+        vectors[numVectors].iov_base = members[i].buffer;
+        vectors[numVectors++].iov_len = members[i].size;
+        position = memberStart + members[i].size;
+        if (extracting) continue;
+        int file = open(members[i].fileName, O_RDONLY);
+        ssize_t bytesRead = file != -1 ? pread(file, members[i].buffer, members[i].size, 0) : -1;
+        if (file != -1) countCall(work->star, IO_READ, bytesRead);
+        if (bytesRead == members[i].size)
+            members[i].moved = RING_MOVED; // Until the run is written
+        if (file != -1) close(file);
+    }
+    if (buffer == NULL || vectors == NULL){ // Left for the usual path
+        free(buffer);
+        free(vectors);
+        return 0;
+    }
+    ssize_t bytesMoved = extracting ? preadv(work->tarFile, vectors, numVectors, run->start) : pwritev(work->tarFile, vectors, numVectors, run->start);
+    countCall(work->star, extracting ? IO_READ : IO_WRITE, bytesMoved);
+    if (extracting && bytesMoved == run->end - run->start){
+        for (int i = 0; i < run->count; i++){
+            int file = open(members[i].fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666); // Like openFile with option 1
+            ssize_t bytesWritten = file != -1 ? pwrite(file, members[i].buffer, members[i].size, 0) : -1;
+            if (file != -1) countCall(work->star, IO_WRITE, bytesWritten);
+            if (bytesWritten == members[i].size)
+                members[i].moved = RING_MOVED;
+            if (file != -1) close(file);
+        }
+    }else if (!extracting && bytesMoved != run->end - run->start){
+        for (int i = 0; i < run->count; i++) // The usual path writes them again
+            members[i].moved = 0;
+    } // The members that could not be read are written anyway, the usual path writes their ranges again
+    for (int i = 0; i < run->count; i++)
+        if (members[i].moved == RING_MOVED)
+            members[i].checksum = updateChecksum(0, members[i].buffer, members[i].size);
+    free(buffer);
+    free(vectors);
+    return 0;
+}
+
+/*
+    Function to move small members with vectored system calls. The members are sorted by their position in the tar file
+    and split in runs of members that are next to each other, up to VECTOR_RUN_SIZE bytes and VECTOR_RUN_MEMBERS members.
+    Every run takes one preadv or pwritev on the tar file, so thousands of tiny members are moved with a few big sequential
+    operations. Runs that are read can jump gaps of up to VECTOR_GAP_LIMIT bytes (deleted files or blank spaces),
+    runs that are written can not, because the gaps must not be overwritten.
+    The runs are moved by numThreads threads. Members that can not be moved are left for the usual path, like with runRingTransfers.
+    transfers is sorted in place.
+*/
+static void runVectoredTransfers(struct Star * star, int tarFile, struct MemberTransfer * transfers, int numTransfers){
+    for (int i = 0; i < numTransfers; i++)
+        transfers[i].moved = 0;
+    if (numTransfers == 0) return;
+    qsort(transfers, numTransfers, sizeof(struct MemberTransfer), compareTransfersByPosition);
+    struct VectorRun * runs = (struct VectorRun *)malloc(numTransfers * sizeof(struct VectorRun));
+    if (runs == NULL) return; // Left for the usual path
+    int numRuns = 0;
+    off_t gapLimit = transfers[0].fromNamed ? 0 : VECTOR_GAP_LIMIT;
+    for (int i = 0; i < numTransfers; i++){
+        off_t start = getTarPosition(&transfers[i]);
+        struct VectorRun * last = numRuns > 0 ? &runs[numRuns - 1] : NULL;
+        if (last != NULL && start >= last->end && start - last->end <= gapLimit && last->count < VECTOR_RUN_MEMBERS &&
+            start + transfers[i].size - last->start <= VECTOR_RUN_SIZE){
+            last->count++;
+            last->end = start + transfers[i].size;
+        }else{
+            struct VectorRun run = {i, 1, start, start + transfers[i].size};
+            runs[numRuns++] = run;
+        }
+    }
+    struct VectorWork work = {star, tarFile, transfers, runs};
+    runInParallel(star, numRuns, star->options.numThreads, moveRunJob, &work);
+    free(runs);
+}
+
+/*
+    Function to move small members in batches, with the engine of the options: io_uring with --uring, otherwise vectored system calls.
+    Members that can not be moved are left for the usual path.
+*/
+static void moveSmallMembers(struct Star * star, int tarFile, struct MemberTransfer * transfers, int numTransfers){
+    if (star->options.ioMode == STAR_IO_URING)
+        runRingTransfers(star, tarFile, transfers, numTransfers);
+    else
+        runVectoredTransfers(star, tarFile, transfers, numTransfers);
+}
+
+/*
+    Returns the hash of the DICTIONARY_KMER bytes at 'data', in DICTIONARY_HASH_BITS bits.
+*/
+static uint32_t hashKmer(const unsigned char * data){
+    uint64_t kmer;
+    memcpy(&kmer, data, sizeof(kmer));
+    return (uint32_t)((kmer * 0x9E3779B97F4A7C15ULL) >> (64 - DICTIONARY_HASH_BITS));
+}
+
+/*
+    Segment of the samples chosen for the dictionary.
+*/
+struct Segment {
+    off_t start; // Position in the samples
+    uint64_t score; // Sum of the frequencies of its k-mers
+};
+
+/*
+    Function to compare two segments by their score. Used to sort them with qsort.
+*/
+static int compareSegmentsByScore(const void * first, const void * second){
+    uint64_t firstScore = ((const struct Segment *)first)->score;
+    uint64_t secondScore = ((const struct Segment *)second)->score;
+    return (firstScore > secondScore) - (firstScore < secondScore);
+}
+
+/*
+    Function to train the dictionary from a sample of the small files (up to DICTIONARY_MEMBER_LIMIT bytes).
+    Every k-mer (DICTIONARY_KMER bytes) is counted once per file in which it appears.
+    The samples are split in one epoch per segment of the dictionary, and the segment of each epoch
+    whose k-mers are in the most files is chosen. Its k-mers are not counted again, so the segments do not repeat.
+    The best segments go at the end of the dictionary, closest to the data, where zlib finds them with shorter distances.
+    The dictionary is left in memory, without a position in the tar file (storeDictionary).
+    Returns -1 if error.
+*/
+static int trainDictionary(struct Star * star, int numFiles, const char * fileNames[], struct File * files){
+    off_t candidateBytes = 0;
+    int numCandidates = 0;
+    for (int i = 0; i < numFiles; i++)
+        if (files[i].originalSize != 0 && files[i].originalSize <= DICTIONARY_MEMBER_LIMIT){
+            candidateBytes += files[i].originalSize;
+            numCandidates++;
+        }
+    if (numCandidates < DICTIONARY_MIN_SAMPLES){
+        report(star, "Not enough small files to train a dictionary.\n");
+        return 0;
+    }
+
+    // Samples: whole files, spread over the list if they do not fit
+    int step = candidateBytes / DICTIONARY_SAMPLE_LIMIT + 1;
+    unsigned char * samples = (unsigned char *)malloc(DICTIONARY_SAMPLE_LIMIT + DICTIONARY_MEMBER_LIMIT);
+    uint32_t * hashes = (uint32_t *)malloc((DICTIONARY_SAMPLE_LIMIT + DICTIONARY_MEMBER_LIMIT) * sizeof(uint32_t));
+    uint32_t * counts = (uint32_t *)calloc((size_t)1 << DICTIONARY_HASH_BITS, sizeof(uint32_t));
+    int * lastSample = (int *)malloc(((size_t)1 << DICTIONARY_HASH_BITS) * sizeof(int));
+    if (samples == NULL || hashes == NULL || counts == NULL || lastSample == NULL){
+        free(samples);
+        free(hashes);
+        free(counts);
+        free(lastSample);
+        return setError(star, STAR_ERROR_MEMORY, "trainDictionary: Error Malloc for the samples.");
+    }
+    memset(lastSample, -1, ((size_t)1 << DICTIONARY_HASH_BITS) * sizeof(int));
+    off_t samplesSize = 0;
+    int numSamples = 0;
+    for (int i = 0, candidate = 0; i < numFiles && samplesSize < DICTIONARY_SAMPLE_LIMIT; i++){
+        if (files[i].originalSize == 0 || files[i].originalSize > DICTIONARY_MEMBER_LIMIT) continue;
+        if (candidate++ % step != 0) continue;
+        int file = open(fileNames[i], O_RDONLY);
+        if (file == -1 || readFully(star, file, samples + samplesSize, files[i].originalSize, 0) != files[i].originalSize){
+            if (file != -1) close(file);
+            free(samples);
+            free(hashes);
+            free(counts);
+            free(lastSample);
+            return setError(star, STAR_ERROR_IO, "trainDictionary: Error reading \"%s\".", fileNames[i]);
+        }
+        close(file);
+        for (off_t position = samplesSize; position < samplesSize + files[i].originalSize; position++){
+            if (position + DICTIONARY_KMER > samplesSize + files[i].originalSize){ // The k-mer would go into the next file
+                hashes[position] = UINT32_MAX;
+                continue;
+            }
+            uint32_t hash = hashes[position] = hashKmer(samples + position);
+            if (lastSample[hash] != numSamples){ // Once per file
+                lastSample[hash] = numSamples;
+                counts[hash]++;
+            }
+        }
+        samplesSize += files[i].originalSize;
+        numSamples++;
+    }
+
+    // Best segment of every epoch
+    int numSegments = DICTIONARY_SIZE / DICTIONARY_SEGMENT_SIZE;
+    struct Segment * segments = (struct Segment *)malloc(numSegments * sizeof(struct Segment));
+    if (segments == NULL){
+        free(samples);
+        free(hashes);
+        free(counts);
+        free(lastSample);
+        return setError(star, STAR_ERROR_MEMORY, "trainDictionary: Error Malloc for the segments.");
+    }
+    off_t epochSize = samplesSize / numSegments;
+    if (epochSize < DICTIONARY_SEGMENT_SIZE) epochSize = DICTIONARY_SEGMENT_SIZE;
+    int numChosen = 0;
+    for (off_t epoch = 0; epoch + DICTIONARY_SEGMENT_SIZE <= samplesSize && numChosen < numSegments; epoch += epochSize){
+        off_t epochEnd = epoch + epochSize < samplesSize ? epoch + epochSize : samplesSize;
+        uint64_t score = 0, bestScore = 0;
+        off_t bestStart = -1;
+        for (off_t position = epoch; position < epochEnd; position++){ // Window of a segment that slides over the epoch
+            if (hashes[position] != UINT32_MAX) score += counts[hashes[position]];
+            off_t start = position - DICTIONARY_SEGMENT_SIZE + 1;
+            if (start < epoch) continue;
+            if (score > bestScore){
+                bestScore = score;
+                bestStart = start;
+            }
+            if (hashes[start] != UINT32_MAX) score -= counts[hashes[start]];
+        }
+        if (bestStart == -1 || bestScore <= DICTIONARY_SEGMENT_SIZE) continue; // Its k-mers are only in one file
+        segments[numChosen].start = bestStart;
+        segments[numChosen++].score = bestScore;
+        for (off_t position = bestStart; position < bestStart + DICTIONARY_SEGMENT_SIZE; position++)
+            if (hashes[position] != UINT32_MAX) counts[hashes[position]] = 0;
+    }
+    qsort(segments, numChosen, sizeof(struct Segment), compareSegmentsByScore);
+
+    if (numChosen > 0)
+        star->dictionary.data = (unsigned char *)malloc(numChosen * DICTIONARY_SEGMENT_SIZE);
+    if (numChosen > 0 && star->dictionary.data != NULL){
+        for (int i = 0; i < numChosen; i++)
+            memcpy(star->dictionary.data + i * DICTIONARY_SEGMENT_SIZE, samples + segments[i].start, DICTIONARY_SEGMENT_SIZE);
+        star->dictionary.size = numChosen * DICTIONARY_SEGMENT_SIZE;
+        star->dictionary.start = 0;
+        report(star, "Trained a dictionary of %lld bytes from %d files.\n", (long long)star->dictionary.size, numSamples);
+    }else if (numChosen == 0){
+        report(star, "The small files have nothing in common, no dictionary is used.\n");
+    }
+    free(segments);
+    free(samples);
+    free(hashes);
+    free(counts);
+    free(lastSample);
+    if (numChosen > 0 && star->dictionary.data == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "trainDictionary: Error Malloc for the dictionary.");
+    return 0;
+}
+
+/*
+    Function to compress a block with zlib. If useDictionary, the dictionary of the tar file is used.
+    storedSize is the capacity of 'output', and gets the bytes written.
+    Returns Z_OK if the block was compressed.
+*/
+static int compressBlock(struct Star * star, unsigned char * output, uLongf * storedSize, const unsigned char * input, size_t size, int useDictionary){
+    if (!useDictionary)
+        return compress2(output, storedSize, input, size, star->options.compressionLevel);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit(&stream, star->options.compressionLevel) != Z_OK) return Z_MEM_ERROR;
+    deflateSetDictionary(&stream, star->dictionary.data, star->dictionary.size);
+    stream.next_in = (unsigned char *)input;
+    stream.avail_in = size;
+    stream.next_out = output;
+    stream.avail_out = *storedSize;
+    int result = deflate(&stream, Z_FINISH);
+    *storedSize = stream.total_out;
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? Z_OK : Z_BUF_ERROR;
+}
+
+/*
+    Function to decompress a block compressed by compressBlock.
+    The block tells if it needs the dictionary of the tar file.
+    size is the capacity of 'output', and gets the bytes written.
+    Returns Z_OK if the block was decompressed.
+*/
+static int decompressBlock(struct Star * star, unsigned char * output, uLongf * size, const unsigned char * input, size_t storedSize){
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) return Z_MEM_ERROR;
+    stream.next_in = (unsigned char *)input;
+    stream.avail_in = storedSize;
+    stream.next_out = output;
+    stream.avail_out = *size;
+    int result = inflate(&stream, Z_FINISH);
+    if (result == Z_NEED_DICT && star->dictionary.size != 0 &&
+        inflateSetDictionary(&stream, star->dictionary.data, star->dictionary.size) == Z_OK)
+        result = inflate(&stream, Z_FINISH);
+    *size = stream.total_out;
+    inflateEnd(&stream);
+    return result == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
+}
+
+/*
+    Block of a file that is compressed by a thread. Job of runInParallel used by compressFiles.
+*/
+struct CompressionBlock {
+    struct Star * star;
+    int file; // Position of the file in the list of files
+    int source; // Identifier of the file
+    off_t position; // Position of the block in the file
+    size_t size; // Bytes of the block
+    unsigned char * data; // Compressed block, or the block as it is if it does not get smaller
+    int useDictionary; // 1 if the block is compressed with the dictionary
+    uint32_t storedSize; // Bytes in data. With BLOCK_STORED_RAW if the block is stored as it is
+};
+
+/*
+    Function that compresses one block. Job of runInParallel used by compressFiles.
+    index is the position of the block in the array of blocks given as context.
+*/
+static int compressBlockJob(int index, void * context){
+    struct CompressionBlock * block = &((struct CompressionBlock *)context)[index];
+    unsigned char input[COMPRESSION_BLOCK_SIZE];
+    if (readFully(block->star, block->source, input, block->size, block->position) != (ssize_t)block->size)
+        return setError(block->star, STAR_ERROR_IO, "compressFiles: Error reading a file to be compressed.");
+    uLongf storedSize = compressBound(COMPRESSION_BLOCK_SIZE);
+    if (compressBlock(block->star, block->data, &storedSize, input, block->size, block->useDictionary) == Z_OK && storedSize < block->size){
+        block->storedSize = storedSize;
+    }else{ // It does not get smaller, so it is stored as it is
+        memcpy(block->data, input, block->size);
+        block->storedSize = block->size | BLOCK_STORED_RAW;
+    }
+    return 0;
+}
+
+/*
+    Function to create the temporary file (the spool) of compressFiles and dedupFiles. It is created in the directory
+    of the tar file, so it is on the same disk, which has room for the files anyway, and the kernel moves its content
+    to the tar file (copy_file_range) instead of writing it again. /tmp is often in memory, and it is only used,
+    through TMPDIR, if the directory of the tar file does not allow it. The spool is removed when it is closed.
+    spoolName gets its name, for the errors of the caller.
+    Returns the identifier of the spool, or -1 on error.
+*/
+static int openSpool(struct Star * star, const char * caller, char * spoolName){
+    const char * separator = strrchr(star->tarFileName, '/');
+    const char * tmpDirectory = getenv("TMPDIR") != NULL && *getenv("TMPDIR") != '\0' ? getenv("TMPDIR") : "/tmp";
+    int spool = -1;
+    int length = separator == NULL ? snprintf(spoolName, SPOOL_NAME_SIZE, ".starXXXXXX") :
+                 snprintf(spoolName, SPOOL_NAME_SIZE, "%.*s/.starXXXXXX", (int)(separator - star->tarFileName), star->tarFileName);
+    if (length < SPOOL_NAME_SIZE) spool = mkstemp(spoolName);
+    if (spool == -1){ // The directory of the tar file is read only, or its name is too long
+        int savedErrno = errno;
+        length = snprintf(spoolName, SPOOL_NAME_SIZE, "%s/starXXXXXX", tmpDirectory);
+        if (length < SPOOL_NAME_SIZE) spool = mkstemp(spoolName);
+        if (spool == -1)
+            return setError(star, STAR_ERROR_IO, "%s: Error creating the temporary file in the directory of the tar file (%s) and in \"%s\" (%s).",
+                            caller, strerror(savedErrno), tmpDirectory, strerror(errno));
+    }
+    unlink(spoolName); // Removed when it is closed
+    return spool;
+}
+
+/*
+    Function to compress files to a temporary file (the spool, openSpool), before they are added to the tar file.
+    Every file is split in blocks of COMPRESSION_BLOCK_SIZE bytes that are compressed independently,
+    so they can be compressed and decompressed by several threads.
+    In the spool, each file is a table with the stored size of every block (uint32_t), followed by the blocks.
+    The blocks of all the files are compressed by numThreads threads, a batch at a time, and written in order.
+    files has the original size of the files, and gets their compressed size.
+    spoolStarts gets the position of each file in the spool.
+    Returns the identifier of the spool, or -1 if error.
+*/
+static int compressFiles(struct Star * star, int numFiles, const char * fileNames[], struct File * files, off_t * spoolStarts){
+    char spoolName[SPOOL_NAME_SIZE];
+    int spool = openSpool(star, "compressFiles", spoolName);
+    if (spool == -1) return -1;
+
+    int batchCapacity = star->options.numThreads * 8; // Blocks compressed at a time
+    struct CompressionBlock * blocks = (struct CompressionBlock *)malloc(batchCapacity * sizeof(struct CompressionBlock));
+    unsigned char * buffers = (unsigned char *)malloc(batchCapacity * compressBound(COMPRESSION_BLOCK_SIZE));
+    if (blocks == NULL || buffers == NULL){
+        free(blocks);
+        free(buffers);
+        close(spool);
+        return setError(star, STAR_ERROR_MEMORY, "compressFiles: Error Malloc for the blocks.");
+    }
+    for (int i = 0; i < batchCapacity; i++){
+        blocks[i].star = star;
+        blocks[i].data = buffers + i * compressBound(COMPRESSION_BLOCK_SIZE);
+    }
+
+    uint32_t * table = NULL; // Table of the file that is being written
+    off_t spoolPosition = 0;
+    int nextFile = 0; // Next block to be compressed
+    off_t nextPosition = 0;
+    int source = -1;
+    int failed = 0; // After an error, the files that are opened are only closed
+    while (!failed && nextFile < numFiles){
+        // Batch with the next blocks, from one or several files
+        int numBlocks = 0;
+        while (numBlocks < batchCapacity && nextFile < numFiles){
+            if (files[nextFile].originalSize == 0){ // Nothing to compress
+                spoolStarts[nextFile] = spoolPosition;
+                files[nextFile++].size = 0;
+                continue;
+            }
+            if (nextPosition == 0){
+                source = open(fileNames[nextFile], O_RDONLY);
+                if (source == -1){
+                    failed = setError(star, STAR_ERROR_IO, "compressFiles: Error opening \"%s\": %s.", fileNames[nextFile], strerror(errno));
+                    break;
+                }
+            }
+            struct CompressionBlock * block = &blocks[numBlocks++];
+            block->file = nextFile;
+            block->source = source;
+            block->position = nextPosition;
+            block->useDictionary = star->dictionary.size != 0 && files[nextFile].originalSize <= DICTIONARY_MEMBER_LIMIT;
+            block->size = files[nextFile].originalSize - nextPosition < COMPRESSION_BLOCK_SIZE ?
+                          files[nextFile].originalSize - nextPosition : COMPRESSION_BLOCK_SIZE;
+            nextPosition += block->size;
+            if (nextPosition == files[nextFile].originalSize){ // Last block of the file
+                nextFile++;
+                nextPosition = 0;
+            }
+        }
+        if (!failed)
+            failed = runInParallel(star, numBlocks, star->options.numThreads, compressBlockJob, blocks);
+
+        // Blocks written in order. The table of each file goes before its blocks
+        for (int i = 0; i < numBlocks; i++){
+            struct CompressionBlock * block = &blocks[i];
+            struct File * file = &files[block->file];
+            off_t numFileBlocks = (file->originalSize + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE;
+            int lastBlock = block->position + block->size == file->originalSize;
+            if (!failed && block->position == 0){ // First block of the file
+                spoolStarts[block->file] = spoolPosition;
+                uint32_t * newTable = (uint32_t *)realloc(table, numFileBlocks * sizeof(uint32_t));
+                if (newTable == NULL)
+                    failed = setError(star, STAR_ERROR_MEMORY, "compressFiles: Error Malloc for the table of blocks.");
+                else
+                    table = newTable;
+                spoolPosition += numFileBlocks * sizeof(uint32_t);
+            }
+            size_t storedSize = block->storedSize & ~BLOCK_STORED_RAW;
+            if (!failed && writeFully(star, spool, block->data, storedSize, spoolPosition) == -1)
+                failed = setError(star, STAR_ERROR_IO, "compressFiles: Error writing the temporary file \"%s\": %s.", spoolName, strerror(errno));
+            if (!failed){
+                table[block->position / COMPRESSION_BLOCK_SIZE] = block->storedSize;
+                spoolPosition += storedSize;
+            }
+            if (!failed && lastBlock &&
+                writeFully(star, spool, table, numFileBlocks * sizeof(uint32_t), spoolStarts[block->file]) == -1)
+                failed = setError(star, STAR_ERROR_IO, "compressFiles: Error writing the temporary file \"%s\": %s.", spoolName, strerror(errno));
+            if (lastBlock){
+                file->size = spoolPosition - spoolStarts[block->file];
+                close(block->source);
+            }
+        }
+    }
+    if (failed && nextPosition != 0) close(source); // File with blocks that were not compressed yet
+    free(table);
+    free(blocks);
+    free(buffers);
+    if (failed){
+        close(spool);
+        return -1;
+    }
+    return spool;
+}
+
+/*
+    Information shared by the threads that decompress the blocks of a file.
+*/
+struct DecompressionWork {
+    struct Star * star;
+    int tarFile;
+    int toFile;
+    const char * map; // Mapping of the tar file. NULL if it is read with system calls
+    const uint32_t * table; // Stored size of every block
+    const off_t * blockStarts; // Position of every block in the tar file
+    off_t originalSize;
+};
+
+/*
+    Function that decompresses one block to its position of the extracted file. Job of runInParallel used by decompressContent.
+    index is the position of the block in the file.
+*/
+static int decompressBlockJob(int index, void * context){
+    struct DecompressionWork * work = (struct DecompressionWork *)context;
+    size_t storedSize = work->table[index] & ~BLOCK_STORED_RAW;
+    off_t position = (off_t)index * COMPRESSION_BLOCK_SIZE;
+    size_t size = work->originalSize - position < COMPRESSION_BLOCK_SIZE ? work->originalSize - position : COMPRESSION_BLOCK_SIZE;
+    unsigned char stored[COMPRESSION_BLOCK_SIZE];
+    unsigned char output[COMPRESSION_BLOCK_SIZE];
+    const unsigned char * input = stored;
+    if (work->map != NULL){
+        input = (const unsigned char *)work->map + work->blockStarts[index];
+        countCall(work->star, IO_MAPPED, storedSize);
+    }
+    else if (readFully(work->star, work->tarFile, stored, storedSize, work->blockStarts[index]) != (ssize_t)storedSize)
+        return setError(work->star, STAR_ERROR_IO, "decompressContent: Error reading a block from tar file.");
+    uLongf outputSize = size;
+    if (work->table[index] & BLOCK_STORED_RAW){
+        if (storedSize != size)
+            return setError(work->star, STAR_ERROR_FORMAT, "decompressContent: A block of the tar file is corrupted.");
+        memcpy(output, input, size);
+    }else if (decompressBlock(work->star, output, &outputSize, input, storedSize) != Z_OK || outputSize != size){
+        return setError(work->star, STAR_ERROR_FORMAT, "decompressContent: A block of the tar file is corrupted.");
+    }
+    if (writeFully(work->star, work->toFile, output, size, position) == -1)
+        return setError(work->star, STAR_ERROR_IO, "decompressContent: Error writing the extracted file: %s.", strerror(errno));
+    return 0;
+}
+
+/*
+    Function to decompress the content of a compressed file of the tar file to the start of 'toFile'.
+    The blocks are decompressed by 'threads' threads.
+    Returns -1 if error.
+*/
+static int decompressContent(struct Star * star, int tarFile, struct File file, int toFile, int threads){
+    off_t numBlocks = (file.originalSize + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE;
+    size_t tableSize = numBlocks * sizeof(uint32_t);
+    uint32_t * table = (uint32_t *)malloc(tableSize);
+    off_t * blockStarts = (off_t *)malloc(numBlocks * sizeof(off_t));
+    if (table == NULL || blockStarts == NULL){
+        free(table);
+        free(blockStarts);
+        return setError(star, STAR_ERROR_MEMORY, "decompressContent: Error Malloc for the table of blocks.");
+    }
+    const char * map = star->options.readMode == STAR_READ_MMAP ? mapSession(star) : NULL;
+    if (map != NULL && file.end > star->session.mapSize) map = NULL; // Added after mapping
+    if (map != NULL){
+        memcpy(table, map + file.start, tableSize);
+    }else if (readFully(star, tarFile, table, tableSize, file.start) != (ssize_t)tableSize){
+        free(table);
+        free(blockStarts);
+        return setError(star, STAR_ERROR_IO, "decompressContent: Error reading the table of blocks from tar file.");
+    }
+    off_t position = file.start + tableSize;
+    for (off_t i = 0; i < numBlocks; i++){
+        blockStarts[i] = position;
+        position += table[i] & ~BLOCK_STORED_RAW;
+        if ((table[i] & ~BLOCK_STORED_RAW) > COMPRESSION_BLOCK_SIZE) position = file.end + 1; // Never bigger than a block
+    }
+    if (position != file.end){
+        free(table);
+        free(blockStarts);
+        return setError(star, STAR_ERROR_FORMAT, "decompressContent: The table of blocks of \"%s\" is corrupted.", file.fileName);
+    }
+    struct DecompressionWork work = {star, tarFile, toFile, map, table, blockStarts, file.originalSize};
+    int result = runInParallel(star, numBlocks, threads, decompressBlockJob, &work);
+    free(table);
+    free(blockStarts);
+    return result;
+}
+
+/*
+    Returns a random priority for a new blank space (xorshift).
+*/
+static unsigned int randomPriority(struct Star * star){
+    star->prioritySeed ^= star->prioritySeed << 13;
+    star->prioritySeed ^= star->prioritySeed >> 17;
+    star->prioritySeed ^= star->prioritySeed << 5;
+    return star->prioritySeed;
+}
+
+/*
+    Function to compare two blank spaces in one of the trees.
+    tree is BY_START (compares the start) or BY_SIZE (compares the size, and then the start).
+    Returns a negative number, 0 or a positive number if first goes before, is the same or goes after second.
+*/
+static int compareBlankSpaces(struct BlankSpace * first, struct BlankSpace * second, int tree){
+    if (tree == BY_SIZE){
+        off_t firstSize = first->end - first->start;
+        off_t secondSize = second->end - second->start;
+        if (firstSize != secondSize) return firstSize < secondSize ? -1 : 1;
+    }
+    return (first->start > second->start) - (first->start < second->start);
+}
+
+/*
+    Function to insert a blank space in one of the trees.
+    root is the root of the tree (or subtree).
+    Returns the new root.
+*/
+static struct BlankSpace * insertInTree(struct BlankSpace * root, struct BlankSpace * newBlankSpace, int tree){
+    if (root == NULL) return newBlankSpace;
+    if (compareBlankSpaces(newBlankSpace, root, tree) < 0){
+        root->left[tree] = insertInTree(root->left[tree], newBlankSpace, tree);
+        if (root->left[tree]->priority > root->priority){ // Rotates to the right
+            struct BlankSpace * newRoot = root->left[tree];
+            root->left[tree] = newRoot->right[tree];
+            newRoot->right[tree] = root;
+            return newRoot;
+        }
+    }else{
+        root->right[tree] = insertInTree(root->right[tree], newBlankSpace, tree);
+        if (root->right[tree]->priority > root->priority){ // Rotates to the left
+            struct BlankSpace * newRoot = root->right[tree];
+            root->right[tree] = newRoot->left[tree];
+            newRoot->left[tree] = root;
+            return newRoot;
+        }
+    }
+    return root;
+}
+
+/*
+    Function to join two trees where all the blank spaces of 'first' go before the ones of 'second'.
+    Returns the root of the joined tree.
+*/
+static struct BlankSpace * joinTrees(struct BlankSpace * first, struct BlankSpace * second, int tree){
+    if (first == NULL) return second;
+    if (second == NULL) return first;
+    if (first->priority > second->priority){
+        first->right[tree] = joinTrees(first->right[tree], second, tree);
+        return first;
+    }
+    second->left[tree] = joinTrees(first, second->left[tree], tree);
+    return second;
+}
+
+/*
+    Function to remove a blank space from one of the trees. The blank space is not freed.
+    Returns the new root.
+*/
+static struct BlankSpace * removeFromTree(struct BlankSpace * root, struct BlankSpace * blankSpace, int tree){
+    if (root == NULL) return NULL;
+    if (root == blankSpace)
+        return joinTrees(root->left[tree], root->right[tree], tree);
+    if (compareBlankSpaces(blankSpace, root, tree) < 0)
+        root->left[tree] = removeFromTree(root->left[tree], blankSpace, tree);
+    else
+        root->right[tree] = removeFromTree(root->right[tree], blankSpace, tree);
+    return root;
+}
+
+/*
+    Function to insert a blank space node in both trees.
+*/
+static void insertBlankSpace(struct Star * star, struct BlankSpace * blankSpace){
+    for (int tree = BY_START; tree <= BY_SIZE; tree++){
+        blankSpace->left[tree] = blankSpace->right[tree] = NULL;
+        star->freeSpace.root[tree] = insertInTree(star->freeSpace.root[tree], blankSpace, tree);
+    }
+    star->freeSpace.numBlankSpaces++;
+    star->freeSpace.totalSize += blankSpace->end - blankSpace->start;
+}
+
+/*
+    Function to remove a blank space node from both trees. The node is not freed.
+*/
+static void removeBlankSpace(struct Star * star, struct BlankSpace * blankSpace){
+    for (int tree = BY_START; tree <= BY_SIZE; tree++)
+        star->freeSpace.root[tree] = removeFromTree(star->freeSpace.root[tree], blankSpace, tree);
+    star->freeSpace.numBlankSpaces--;
+    star->freeSpace.totalSize -= blankSpace->end - blankSpace->start;
+}
+
+/*
+    Returns the blank space with the highest start that is lower than 'position', or NULL if there is none.
+*/
+static struct BlankSpace * findBlankSpaceBefore(struct Star * star, off_t position){
+    struct BlankSpace * current = star->freeSpace.root[BY_START];
+    struct BlankSpace * found = NULL;
+    while (current != NULL){
+        if (current->start < position){
+            found = current;
+            current = current->right[BY_START];
+        }else{
+            current = current->left[BY_START];
+        }
+    }
+    return found;
+}
+
+/*
+    Returns the blank space with the lowest start that is higher or equal than 'position', or NULL if there is none.
+*/
+static struct BlankSpace * findBlankSpaceAfter(struct Star * star, off_t position){
+    struct BlankSpace * current = star->freeSpace.root[BY_START];
+    struct BlankSpace * found = NULL;
+    while (current != NULL){
+        if (current->start >= position){
+            found = current;
+            current = current->left[BY_START];
+        }else{
+            current = current->right[BY_START];
+        }
+    }
+    return found;
+}
+
+/*
+    Function to add a blank space.
+    Blank space goes from 'start' to 'end' parameters.
+    If it touches the blank spaces before or after it, they are joined in only one blank space.
+    Returns 1 if added correctly, 0 if it is empty and -1 on error.
+*/
+static int addBlankSpace(struct Star * star, off_t start, off_t end){
+    if (start > end)
+        return setError(star, STAR_ERROR_FORMAT, "addBlankSpace: Start of blank space is higher than end.");
+    if (start == end)
+        return 0;
+
+    struct BlankSpace * previous = findBlankSpaceBefore(star, start);
+    if (previous != NULL && previous->end >= start){ // Joins with the previous one
+        removeBlankSpace(star, previous);
+        start = previous->start;
+        if (previous->end > end) end = previous->end;
+        free(previous);
+    }
+    struct BlankSpace * next;
+    while ((next = findBlankSpaceAfter(star, start)) != NULL && next->start <= end){ // Joins with the next ones
+        removeBlankSpace(star, next);
+        if (next->end > end) end = next->end;
+        free(next);
+    }
+
+    // Create a new node
+    struct BlankSpace * newBlankSpace = (struct BlankSpace*)malloc(sizeof(struct BlankSpace));
+    if (newBlankSpace == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "addBlankSpace: Malloc for new node failed.");
+    newBlankSpace->start = start;
+    newBlankSpace->end = end;
+    newBlankSpace->priority = randomPriority(star);
+    insertBlankSpace(star, newBlankSpace);
+    return 1;
+}
+
+/*
+    Function that finds an available blank space to place a new file.
+    sizeOfNewFile is the size of the new file.
+    Returns the smallest blank space where the file fits (best fit).
+    Returns NULL if there are no blank spaces with enough size.
+*/
+static struct BlankSpace * findBlankSpaceForNewFile(struct Star * star, off_t sizeOfNewFile){
+    struct BlankSpace * current = star->freeSpace.root[BY_SIZE];
+    struct BlankSpace * found = NULL;
+    while (current != NULL){
+        if (current->end - current->start >= sizeOfNewFile){
+            found = current;
+            current = current->left[BY_SIZE]; // Looks for a smaller one
+        }else{
+            current = current->right[BY_SIZE];
+        }
+    }
+    return found;
+}
+
+/*
+    Function to mark the range from 'start' to 'end' as used.
+    The blank spaces in the range are removed or made smaller. With --concurrent the writer locks the range.
+    Returns -1 on error.
+*/
+static int reserveSpace(struct Star * star, off_t start, off_t end){
+    if (lockContent(star, start, end) == -1) return -1; // Everything reserved is written before the header
+    struct BlankSpace * blankSpace;
+    while ((blankSpace = findBlankSpaceBefore(star, end)) != NULL && blankSpace->end > start){
+        removeBlankSpace(star, blankSpace);
+        off_t blankStart = blankSpace->start, blankEnd = blankSpace->end;
+        free(blankSpace);
+        if (blankStart < start && addBlankSpace(star, blankStart, start) == -1) return -1; // Part before the range
+        if (blankEnd > end && addBlankSpace(star, end, blankEnd) == -1) return -1; // Part after the range
+    }
+    return 0;
+}
+
+/*
+    Function to find where to place 'size' bytes and mark them as used.
+    Uses the best blank space. If none is big enough, the bytes go at the end of the content.
+    Returns the start of the reserved space, or -1 on error.
+*/
+static off_t allocateSpace(struct Star * star, off_t size){
+    struct BlankSpace * blankSpace = findBlankSpaceForNewFile(star, size);
+    off_t start = blankSpace != NULL ? blankSpace->start : getEndOfContent(star);
+    if (reserveSpace(star, start, start + size) == -1) return -1;
+    return start;
+}
+
+/*
+    Function to write the dictionary in the tar file, if it was trained and has no position yet.
+    It is placed like a file. The superblock points to it when the header is written.
+*/
+static int storeDictionary(struct Star * star, int tarFile){
+    if (star->dictionary.size == 0 || star->dictionary.start != 0) return 0;
+    off_t start = allocateSpace(star, star->dictionary.size);
+    if (start == -1) return -1;
+    if (writeFully(star, tarFile, star->dictionary.data, star->dictionary.size, start) == -1)
+        return setError(star, STAR_ERROR_IO, "storeDictionary: Error writing the dictionary in tar file: %s.", strerror(errno));
+    star->dictionary.start = start;
+    growSession(star, star->dictionary.start + star->dictionary.size);
+    return markHeaderDirty(star);
+}
+
+/*
+    Function to free every node of a tree of blank spaces.
+*/
+static void freeBlankSpaceTree(struct BlankSpace * root){
+    if (root == NULL) return;
+    freeBlankSpaceTree(root->left[BY_START]);
+    freeBlankSpaceTree(root->right[BY_START]);
+    free(root);
+}
+
+/*
+    Resets and cleans completely the blank spaces.
+*/
+static void resetBlankSpaceList(struct Star * star) {
+    freeBlankSpaceTree(star->freeSpace.root[BY_START]);
+    star->freeSpace.root[BY_START] = star->freeSpace.root[BY_SIZE] = NULL; // The trees are empty
+    star->freeSpace.numBlankSpaces = 0;
+    star->freeSpace.totalSize = 0;
+}
+
+/*
+    Function to call 'action' for every blank space, sorted by start.
+    Stops at the first action that returns -1, and returns -1.
+*/
+static int forEachBlankSpace(struct BlankSpace * root, int (*action)(struct BlankSpace * blankSpace, void * context), void * context){
+    if (root == NULL) return 0;
+    if (forEachBlankSpace(root->left[BY_START], action, context) == -1 || action(root, context) == -1)
+        return -1;
+    return forEachBlankSpace(root->right[BY_START], action, context);
+}
+
+/*
+    Function to print one blank space. Action of forEachBlankSpace, context is the output.
+*/
+static int printBlankSpace(struct BlankSpace * blankSpace, void * context){
+    fprintf((FILE *)context, "BlankSpace ->\tStart: %lld\tEnd: %lld\n", (long long)blankSpace->start, (long long)blankSpace->end);
+    return 0;
+}
+
+/*
+    Function to print the current blank spaces to the output. Nothing is printed without output or with quietMode.
+*/
+static void printBlankSpaces(struct Star * star){
+    FILE * output = star->options.output;
+    if (output == NULL || star->options.quietMode) return;
+    fprintf(output, "\nBLANK SPACES: \n");
+    if (star->freeSpace.numBlankSpaces == 0){
+        fprintf(output, "There are no blank spaces\n");
+        return;
+    }
+    forEachBlankSpace(star->freeSpace.root[BY_START], printBlankSpace, output);
+    fprintf(output, "Total: %d blank spaces, %lld bytes\n", star->freeSpace.numBlankSpaces, (long long)star->freeSpace.totalSize);
+    fprintf(output, "\n");
+
+}
+
+/*
+    Function to compare two files by their start position. Used to sort them with qsort.
+*/
+static int compareFilesByStart(const void * first, const void * second){
+    off_t firstStart = ((const struct File *)first)->start;
+    off_t secondStart = ((const struct File *)second)->start;
+    return (firstStart > secondStart) - (firstStart < secondStart);
+}
+
+/*
+    Function to calculate the blank spaces between the files in the tar file.
+    Only used when the tar file has no free map (older versions).
+    The files, the index, the free map, the dictionary and the chunks are sorted by their position, and every space between them is a blank space.
+    The space after the last of them, until the end of the tar file, is also a blank space.
+    sizeOfTar is the size of the whole tar file.
+    Returns -1 on error.
+*/
+static int calculateSpaceBetweenFilesAux(struct Star * star, off_t sizeOfTar){
+    struct File * usedSpaces = (struct File *)malloc((star->header.numEntries + star->chunkStore.numChunks + 4) * sizeof(struct File));
+    if (usedSpaces == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "calculateBlankSpaces: Malloc for used spaces failed.");
+    int numUsedSpaces = 0;
+    for (int i = 0; i < star->header.numEntries; i++)
+        if (star->header.fileList[i].size != 0)
+            usedSpaces[numUsedSpaces++] = star->header.fileList[i];
+    usedSpaces[numUsedSpaces].start = star->header.indexStart; // The index is also using space
+    usedSpaces[numUsedSpaces].end = star->header.indexStart + star->header.indexCapacity;
+    numUsedSpaces++;
+    usedSpaces[numUsedSpaces].start = star->freeSpace.mapStart; // And the free map
+    usedSpaces[numUsedSpaces].end = star->freeSpace.mapStart + star->freeSpace.mapCapacity;
+    numUsedSpaces++;
+    usedSpaces[numUsedSpaces].start = star->dictionary.start; // And the dictionary
+    usedSpaces[numUsedSpaces].end = star->dictionary.start + star->dictionary.size;
+    numUsedSpaces++;
+    usedSpaces[numUsedSpaces].start = star->chunkStore.tableStart; // And the chunk table and its chunks
+    usedSpaces[numUsedSpaces].end = star->chunkStore.tableStart + star->chunkStore.tableCapacity;
+    numUsedSpaces++;
+    for (int i = 0; i < star->chunkStore.numChunks; i++){
+        if (star->chunkStore.chunks[i].size == 0) continue;
+        usedSpaces[numUsedSpaces].start = star->chunkStore.chunks[i].start;
+        usedSpaces[numUsedSpaces].end = star->chunkStore.chunks[i].start + star->chunkStore.chunks[i].size;
+        numUsedSpaces++;
+    }
+    qsort(usedSpaces, numUsedSpaces, sizeof(struct File), compareFilesByStart);
+
+    off_t position = SUPERBLOCK_SIZE; // End of the last used space
+    int result = 0;
+    for (int i = 0; i < numUsedSpaces && result != -1; i++){
+        if (usedSpaces[i].start > position)
+            result = addBlankSpace(star, position, usedSpaces[i].start);
+        if (usedSpaces[i].end > position)
+            position = usedSpaces[i].end;
+    }
+    if (result != -1 && sizeOfTar > position) // Space after the last file
+        result = addBlankSpace(star, position, sizeOfTar);
+    free(usedSpaces);
+    return result == -1 ? -1 : 0;
+}
+
+/*
+    Function to fill the table of the rolling hash of the chunker with fixed pseudo-random values (splitmix64).
+    They are always the same, so the same content is cut in the same chunks in every tar file.
+*/
+static void initGearTable(){
+    uint64_t seed = 0x5354415244454455ULL;
+    for (int i = 0; i < 256; i++){
+        uint64_t value = (seed += 0x9E3779B97F4A7C15ULL);
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+        gearTable[i] = value ^ (value >> 31);
+    }
+}
+
+/*
+    Function to find where the first chunk of 'data' ends (content-defined chunking with a gear hash).
+    The chunk ends where the hash of the last 64 bytes has the bits of CHUNK_MASK (its top 13) at zero,
+    so an insertion in a file only changes the chunks around it.
+    Returns the size of the chunk, from CHUNK_MIN_SIZE to CHUNK_MAX_SIZE, or less at the end of the data.
+*/
+static size_t findChunkBoundary(const unsigned char * data, size_t size){
+    if (size <= CHUNK_MIN_SIZE) return size;
+    size_t limit = size < CHUNK_MAX_SIZE ? size : CHUNK_MAX_SIZE;
+    uint64_t hash = 0;
+    for (size_t i = CHUNK_MIN_SIZE - 64; i < limit; i++){ // Each byte leaves the hash after 64 more, so it is the same as from 0
+        hash = (hash << 1) + gearTable[data[i]];
+        if (i >= CHUNK_MIN_SIZE && (hash & CHUNK_MASK) == 0)
+            return i + 1;
+    }
+    return limit;
+}
+
+/*
+    Returns the 64-bit hash of the content of a chunk.
+    Two chunks with the same hash are also compared byte by byte before one is used for the other.
+*/
+static uint64_t hashChunk(const unsigned char * data, size_t size){
+    uint64_t hash = 0xCBF29CE484222325ULL ^ size;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)){
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash ^= word * 0x9E3779B97F4A7C15ULL;
+        hash = ((hash << 31) | (hash >> 33)) * 0xC2B2AE3D27D4EB4FULL;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    return hash ^ (hash >> 33);
+}
+
+/*
+    Function to make sure the chunk table has space for 'numChunks' chunks.
+    Returns -1 on error.
+*/
+static int ensureChunkCapacity(struct Star * star, int numChunks){
+    if (numChunks <= star->chunkStore.capacity) return 0;
+    int capacity = star->chunkStore.capacity > 0 ? star->chunkStore.capacity * 2 : MIN_INDEX_SLOTS;
+    if (capacity < numChunks) capacity = numChunks;
+    struct ChunkEntry * chunks = (struct ChunkEntry *)realloc(star->chunkStore.chunks, capacity * sizeof(struct ChunkEntry));
+    if (chunks == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "ensureChunkCapacity: Malloc for the chunks failed.");
+    memset(chunks + star->chunkStore.capacity, 0, (capacity - star->chunkStore.capacity) * sizeof(struct ChunkEntry));
+    star->chunkStore.chunks = chunks;
+    star->chunkStore.capacity = capacity;
+    return 0;
+}
+
+/*
+    Function to build again the table to find the chunks by their hash, with space for twice the chunks.
+    Also calculates where the last chunk ends.
+    Returns -1 on error.
+*/
+static int rebuildChunkIndex(struct Star * star){
+    int size = MIN_INDEX_SLOTS;
+    while (size < star->chunkStore.numChunks * 2 + 2) size *= 2;
+    free(star->chunkStore.hashIndex);
+    star->chunkStore.hashIndex = (int *)malloc(size * sizeof(int));
+    if (star->chunkStore.hashIndex == NULL){
+        star->chunkStore.hashIndexSize = 0;
+        return setError(star, STAR_ERROR_MEMORY, "rebuildChunkIndex: Malloc for the chunk index failed.");
+    }
+    for (int i = 0; i < size; i++) star->chunkStore.hashIndex[i] = NAME_INDEX_EMPTY;
+    star->chunkStore.hashIndexSize = size;
+    star->chunkStore.hashIndexUsed = 0;
+    star->chunkStore.end = 0;
+    for (int i = 0; i < star->chunkStore.numChunks; i++){
+        struct ChunkEntry * chunk = &star->chunkStore.chunks[i];
+        if (chunk->size == 0) continue; // Free position
+        int position = chunk->hash & (size - 1);
+        while (star->chunkStore.hashIndex[position] != NAME_INDEX_EMPTY) position = (position + 1) & (size - 1);
+        star->chunkStore.hashIndex[position] = i;
+        star->chunkStore.hashIndexUsed++;
+        if (chunk->start + chunk->size > star->chunkStore.end) star->chunkStore.end = chunk->start + chunk->size;
+    }
+    return 0;
+}
+
+/*
+    Function to find a chunk of the tar file with the same content as 'data'.
+    The chunks with the same hash are read from the tar file to 'buffer' and compared.
+    Returns its identifier, -1 if there is none or -2 on error.
+*/
+static int findChunk(struct Star * star, int tarFile, uint64_t hash, const unsigned char * data, size_t size, unsigned char * buffer){
+    if (star->chunkStore.hashIndexSize == 0) return -1;
+    int mask = star->chunkStore.hashIndexSize - 1;
+    for (int position = hash & mask; star->chunkStore.hashIndex[position] != NAME_INDEX_EMPTY; position = (position + 1) & mask){
+        int id = star->chunkStore.hashIndex[position];
+        if (id == NAME_INDEX_REMOVED) continue;
+        struct ChunkEntry * chunk = &star->chunkStore.chunks[id];
+        if (chunk->hash != hash || chunk->size != size) continue;
+        if (readFully(star, tarFile, buffer, size, chunk->start) != (ssize_t)size){
+            setError(star, STAR_ERROR_IO, "findChunk: Error reading a chunk from tar file.");
+            return -2;
+        }
+        if (memcmp(buffer, data, size) == 0) return id;
+    }
+    return -1;
+}
+
+/*
+    Function to add a chunk to the chunk table, in the first free position.
+    Returns its identifier, or -1 on error.
+*/
+static int addChunk(struct Star * star, uint64_t hash, off_t start, size_t size){
+    while (star->chunkStore.firstFree < star->chunkStore.numChunks && star->chunkStore.chunks[star->chunkStore.firstFree].size != 0)
+        star->chunkStore.firstFree++;
+    int id = star->chunkStore.firstFree++;
+    if (id == star->chunkStore.numChunks){
+        if (ensureChunkCapacity(star, id + 1) == -1){
+            star->chunkStore.firstFree--;
+            return -1;
+        }
+        star->chunkStore.numChunks++;
+    }
+    struct ChunkEntry * chunk = &star->chunkStore.chunks[id];
+    chunk->hash = hash;
+    chunk->start = start;
+    chunk->size = size;
+    chunk->references = 1;
+    if (start + (off_t)size > star->chunkStore.end) star->chunkStore.end = start + size;
+    if ((star->chunkStore.hashIndexUsed + 1) * 2 > star->chunkStore.hashIndexSize) // Also adds the new chunk
+        return rebuildChunkIndex(star) == -1 ? -1 : id;
+    int mask = star->chunkStore.hashIndexSize - 1;
+    int position = hash & mask;
+    while (star->chunkStore.hashIndex[position] >= 0) position = (position + 1) & mask;
+    if (star->chunkStore.hashIndex[position] == NAME_INDEX_EMPTY) star->chunkStore.hashIndexUsed++;
+    star->chunkStore.hashIndex[position] = id;
+    return id;
+}
+
+/*
+    Function to remove a chunk without references from the chunk table. Its position can be used by a new chunk.
+    The space it used must be freed by the caller.
+*/
+static void removeChunk(struct Star * star, int id){
+    int mask = star->chunkStore.hashIndexSize - 1;
+    int position = star->chunkStore.chunks[id].hash & mask;
+    while (star->chunkStore.hashIndex[position] != id) position = (position + 1) & mask;
+    star->chunkStore.hashIndex[position] = NAME_INDEX_REMOVED;
+    memset(&star->chunkStore.chunks[id], 0, sizeof(struct ChunkEntry));
+    if (id < star->chunkStore.firstFree) star->chunkStore.firstFree = id;
+}
+
+/*
+    Function to empty the chunk table in memory.
+*/
+static void releaseChunkStore(struct Star * star){
+    free(star->chunkStore.chunks);
+    free(star->chunkStore.hashIndex);
+    memset(&star->chunkStore, 0, sizeof(star->chunkStore));
+}
+
+/*
+    Function to store a chunk in the tar file, or to add a reference to the same chunk if it is already stored.
+    A new chunk is placed in the best blank space, or at 'tail', which is moved after it.
+    buffer is used to compare the chunks with the same hash.
+    newChunks and bytesWritten count the chunks that are written.
+    Returns the identifier of the chunk, or -1 on error.
+*/
+static int storeChunk(struct Star * star, int tarFile, const unsigned char * data, size_t size, off_t * tail, unsigned char * buffer, int * newChunks, off_t * bytesWritten){
+    uint64_t hash = hashChunk(data, size);
+    int id = findChunk(star, tarFile, hash, data, size, buffer);
+    if (id == -2) return -1;
+    if (id != -1){
+        star->chunkStore.chunks[id].references++;
+        return id;
+    }
+    struct BlankSpace * blankSpace = findBlankSpaceForNewFile(star, size);
+    off_t start = blankSpace != NULL ? blankSpace->start : *tail;
+    if (reserveSpace(star, start, start + size) == -1) return -1; // At the tail it can be the blank space at the end of the tar file
+    if (start + (off_t)size > *tail) *tail = start + size; // The blank space can be the one at the end
+    if (writeFully(star, tarFile, data, size, start) == -1)
+        return setError(star, STAR_ERROR_IO, "storeChunk: Error writing a chunk in tar file: %s.", strerror(errno));
+    growSession(star, start + size);
+    (*newChunks)++;
+    *bytesWritten += size;
+    return addChunk(star, hash, start, size);
+}
+
+/*
+    Function to deduplicate the files to be added to the tar file (--dedup).
+    Every file is cut in chunks by its content (findChunkBoundary). Only the chunks that are not in the tar file yet
+    are written, straight to the tar file. The list of identifiers of its chunks (uint32_t) is stored instead of the file.
+    The lists are written to a temporary file (the spool, openSpool), and are copied to the tar file like any other content.
+    The header and the blank spaces of the tar file must be loaded.
+    files has the original size of the files, and gets the size of their list of chunks.
+    spoolStarts gets the position of each list in the spool.
+    Returns the identifier of the spool, or -1 on error.
+*/
+static int dedupFiles(struct Star * star, int tarFile, int numFiles, const char * fileNames[], struct File * files, off_t * spoolStarts){
+    char spoolName[SPOOL_NAME_SIZE];
+    int spool = openSpool(star, "dedupFiles", spoolName);
+    if (spool == -1) return -1;
+    unsigned char * buffer = (unsigned char *)malloc(DEDUP_BUFFER_SIZE);
+    unsigned char * compareBuffer = (unsigned char *)malloc(CHUNK_MAX_SIZE);
+    uint32_t * chunkIds = NULL; // List of chunks of the file that is being read
+    int failed = 0;
+    if (buffer == NULL || compareBuffer == NULL)
+        failed = setError(star, STAR_ERROR_MEMORY, "dedupFiles: Malloc for the buffers failed.");
+    if (!failed && star->chunkStore.hashIndex == NULL)
+        failed = rebuildChunkIndex(star);
+
+    int capacity = 0;
+    off_t tail = getEndOfContent(star); // New chunks without a blank space go here
+    off_t spoolPosition = 0, bytesWritten = 0;
+    int newChunks = 0;
+    for (int i = 0; i < numFiles && !failed; i++){
+        spoolStarts[i] = spoolPosition;
+        if (files[i].originalSize == 0) continue;
+        int source = open(fileNames[i], O_RDONLY);
+        if (source == -1){
+            failed = setError(star, STAR_ERROR_IO, "dedupFiles: Error opening \"%s\": %s.", fileNames[i], strerror(errno));
+            break;
+        }
+        int numChunks = 0;
+        off_t position = 0;
+        while (position < files[i].originalSize && !failed){
+            size_t available = files[i].originalSize - position < DEDUP_BUFFER_SIZE ? files[i].originalSize - position : DEDUP_BUFFER_SIZE;
+            if (readFully(star, source, buffer, available, position) != (ssize_t)available){
+                failed = setError(star, STAR_ERROR_IO, "dedupFiles: Error reading \"%s\".", fileNames[i]);
+                break;
+            }
+            int lastBuffer = position + (off_t)available == files[i].originalSize;
+            size_t used = 0;
+            while (used < available && (lastBuffer || available - used >= CHUNK_MAX_SIZE)){ // A whole chunk fits
+                size_t size = findChunkBoundary(buffer + used, available - used);
+                if (numChunks == capacity){
+                    capacity = capacity > 0 ? capacity * 2 : 1024;
+                    uint32_t * grown = (uint32_t *)realloc(chunkIds, capacity * sizeof(uint32_t));
+                    if (grown == NULL){
+                        failed = setError(star, STAR_ERROR_MEMORY, "dedupFiles: Malloc for the list of chunks failed.");
+                        break;
+                    }
+                    chunkIds = grown;
+                }
+                int id = storeChunk(star, tarFile, buffer + used, size, &tail, compareBuffer, &newChunks, &bytesWritten);
+                if (id == -1){
+                    failed = -1;
+                    break;
+                }
+                chunkIds[numChunks++] = id;
+                used += size;
+            }
+            position += used; // The rest is read again with the next buffer
+        }
+        close(source);
+        if (failed) break;
+        files[i].size = (off_t)numChunks * sizeof(uint32_t);
+        if (writeFully(star, spool, chunkIds, files[i].size, spoolPosition) == -1){
+            failed = setError(star, STAR_ERROR_IO, "dedupFiles: Error writing the temporary file \"%s\": %s.", spoolName, strerror(errno));
+            break;
+        }
+        spoolPosition += files[i].size;
+    }
+    free(chunkIds);
+    free(buffer);
+    free(compareBuffer);
+    if (failed){
+        close(spool);
+        return -1;
+    }
+    off_t originalBytes = 0;
+    for (int i = 0; i < numFiles; i++) originalBytes += files[i].originalSize;
+    report(star, "Deduplicated %lld bytes: %d new chunk(s), %lld bytes written\n", (long long)originalBytes,
+                 newChunks, (long long)bytesWritten);
+    return spool;
+}
+
+/*
+    Function to read the chunk table from the tar file. numChunks is the amount of positions used in it.
+    Returns -1 on error.
+*/
+static int readChunkTable(struct Star * star, int tarFile, off_t tableStart, off_t tableCapacity, int numChunks){
+    releaseChunkStore(star);
+    if ((off_t)numChunks * sizeof(struct ChunkEntry) > tableCapacity)
+        return setError(star, STAR_ERROR_FORMAT, "readChunkTable: The chunk table of the tar file is corrupted.");
+    if (ensureChunkCapacity(star, numChunks) == -1) return -1;
+    size_t bytes = (size_t)numChunks * sizeof(struct ChunkEntry);
+    if (readFully(star, tarFile, star->chunkStore.chunks, bytes, tableStart) != (ssize_t)bytes)
+        return setError(star, STAR_ERROR_IO, "readChunkTable: It was not possible to read the chunk table from tar file.");
+    star->chunkStore.numChunks = numChunks;
+    star->chunkStore.tableStart = tableStart;
+    star->chunkStore.tableCapacity = tableCapacity;
+    return rebuildChunkIndex(star);
+}
+
+/*
+    Function to write the chunk table in the tar file.
+    If it does not fit in its block, it is moved to a new block with space for twice the chunks.
+    Returns -1 on error.
+*/
+static int writeChunkTableToTar(struct Star * star, int tarFile){
+    if (star->chunkStore.numChunks == 0 && star->chunkStore.tableStart == 0) return 0; // No deduplicated files
+    off_t bytes = (off_t)star->chunkStore.numChunks * sizeof(struct ChunkEntry);
+    if (bytes > star->chunkStore.tableCapacity){
+        if (star->chunkStore.tableStart != 0 &&
+            addBlankSpace(star, star->chunkStore.tableStart, star->chunkStore.tableStart + star->chunkStore.tableCapacity) == -1)
+            return -1;
+        star->chunkStore.tableCapacity = bytes * 2 > MIN_FREE_MAP_CAPACITY ? bytes * 2 : MIN_FREE_MAP_CAPACITY;
+        star->chunkStore.tableStart = 0; // The old block is a blank space now, it can be used
+        star->chunkStore.tableStart = allocateSpace(star, star->chunkStore.tableCapacity);
+        if (star->chunkStore.tableStart == -1) return -1;
+        growSession(star, star->chunkStore.tableStart + star->chunkStore.tableCapacity);
+    }
+    if (writeFully(star, tarFile, star->chunkStore.chunks, bytes, star->chunkStore.tableStart) == -1)
+        return setError(star, STAR_ERROR_IO, "writeChunkTableToTar: Error writing the chunk table in tar file: %s.", strerror(errno));
+    return 0;
+}
+
+/*
+    Function to copy the content of a deduplicated file of the tar file to the start of 'toFile', chunk by chunk.
+    With --verify, every chunk goes through a buffer and its hash is checked before it is written.
+    Returns -1 if error.
+*/
+static int extractChunks(struct Star * star, int tarFile, struct File file, int toFile){
+    int numChunks = file.size / sizeof(uint32_t);
+    uint32_t * chunkIds = (uint32_t *)malloc(file.size);
+    unsigned char * buffer = star->options.verifyMode ? (unsigned char *)malloc(CHUNK_MAX_SIZE) : NULL;
+    int failed = 0;
+    if (chunkIds == NULL || (star->options.verifyMode && buffer == NULL))
+        failed = setError(star, STAR_ERROR_MEMORY, "extractChunks: Malloc for the list of chunks failed.");
+    else if (readFully(star, tarFile, chunkIds, file.size, file.start) != (ssize_t)file.size)
+        failed = setError(star, STAR_ERROR_IO, "extractChunks: Error reading the list of chunks from tar file.");
+    off_t position = 0;
+    for (int i = 0; i < numChunks && !failed; i++){
+        if (chunkIds[i] >= (uint32_t)star->chunkStore.numChunks || star->chunkStore.chunks[chunkIds[i]].size == 0){
+            failed = setError(star, STAR_ERROR_FORMAT, "extractChunks: The list of chunks of \"%s\" is corrupted.", file.fileName);
+            break;
+        }
+        struct ChunkEntry * chunk = &star->chunkStore.chunks[chunkIds[i]];
+        if (star->options.verifyMode){
+            if (chunk->size > CHUNK_MAX_SIZE || readFully(star, tarFile, buffer, chunk->size, chunk->start) != (ssize_t)chunk->size ||
+                hashChunk(buffer, chunk->size) != chunk->hash)
+                failed = setError(star, STAR_ERROR_CORRUPTED, "extractChunks: A chunk of \"%s\" is corrupted.", file.fileName);
+            else if (writeFully(star, toFile, buffer, chunk->size, position) == -1)
+                failed = setError(star, STAR_ERROR_IO, "extractChunks: Error writing \"%s\": %s.", file.fileName, strerror(errno));
+        }else{
+            failed = copyContent(star, tarFile, chunk->start, toFile, position, chunk->size) == -1 ? -1 : 0;
+        }
+        position += chunk->size;
+    }
+    free(chunkIds);
+    free(buffer);
+    if (failed) return -1;
+    if (position != file.originalSize)
+        return setError(star, STAR_ERROR_FORMAT, "extractChunks: The list of chunks of \"%s\" is corrupted.", file.fileName);
+    return 0;
+}
+
+/*
+    Function to get the information of the files to be added to the tar file, without their positions.
+    With --compress, the files are compressed first (compressFiles), and their size is the compressed one.
+    With --dictionary, a dictionary is trained for the small files if the tar file does not have one yet.
+    With --dedup, the new chunks of the files are written to the tar file (dedupFiles), and their size is the one
+    of their list of chunks. The tar file must be opened, with its header and blank spaces loaded.
+    spoolStarts gets the position of each file in the spool.
+    Returns the identifier of the spool, -1 if the files are stored as they are, or -2 on error.
+*/
+static int prepareFiles(struct Star * star, int numFiles, const char * fileNames[], struct File * files, off_t * spoolStarts){
+    for (int i = 0; i < numFiles; i++){
+        struct stat fileStat;
+        if (lstat(fileNames[i], &fileStat) == -1) { // Extracts file info and saves it on fileStat
+            setError(star, STAR_ERROR_IO, "prepareFiles: Error getting info of \"%s\": %s.", fileNames[i], strerror(errno));
+            return -2;
+        }
+        memset(&files[i], 0, sizeof(struct File));
+        files[i].fileName = (char *)fileNames[i];
+        files[i].mode = fileStat.st_mode;
+        files[i].size = files[i].originalSize = fileStat.st_size;
+        files[i].compressed = star->options.compressionLevel != 0;
+        files[i].chunked = star->options.dedupMode;
+    }
+    if (star->options.dedupMode){
+        int spool = dedupFiles(star, star->session.tarFile, numFiles, fileNames, files, spoolStarts);
+        return spool == -1 ? -2 : spool;
+    }
+    if (star->options.compressionLevel == 0) return -1;
+    if (star->options.dictionaryMode && star->dictionary.size == 0 && // Only once. The next files use the same dictionary
+        trainDictionary(star, numFiles, fileNames, files) == -1)
+        return -2;
+
+    double startTime = currentSeconds();
+    int spool = compressFiles(star, numFiles, fileNames, files, spoolStarts);
+    if (spool == -1) return -2;
+    double elapsed = currentSeconds() - startTime;
+    off_t originalBytes = 0, storedBytes = 0;
+    for (int i = 0; i < numFiles; i++){
+        originalBytes += files[i].originalSize;
+        storedBytes += files[i].size;
+    }
+    report(star, "Compressed %lld bytes to %lld bytes in %.3f seconds with %d thread(s): %.2f MB/s\n", (long long)originalBytes,
+                 (long long)storedBytes, elapsed, star->options.numThreads, elapsed > 0 ? originalBytes / elapsed / (1024 * 1024) : 0.0);
+    return spool;
+}
+
+/*
+    Function to empty the header, freeing its file list and names, and the blank spaces.
+    The position of the index in the tar file is not modified.
+*/
+static void releaseHeader(struct Star * star){
+    resetBlankSpaceList(star);
+    star->freeSpace.loaded = 0;
+    star->freeSpace.mapStart = 0;
+    star->freeSpace.mapCapacity = 0;
+    star->freeSpace.mapCount = 0;
+    star->freeSpace.mapValid = 0;
+    free(star->header.fileList);
+    star->header.fileList = NULL;
+    star->header.numEntries = 0;
+    star->header.capacity = 0;
+    star->header.loaded = 0;
+    star->header.namesMapped = 0;
+    star->header.oldFormat = 0;
+    star->header.namesSize = 0;
+    free(star->header.dirtyEntries);
+    star->header.dirtyEntries = NULL;
+    star->header.numDirty = 0;
+    star->header.dirtyCapacity = 0;
+    free(star->header.nameIndex);
+    star->header.nameIndex = NULL;
+    star->header.nameIndexSize = 0;
+    star->header.nameIndexUsed = 0;
+    while (star->header.names != NULL){
+        struct NameBlock * nextBlock = star->header.names->nextBlock;
+        free(star->header.names);
+        star->header.names = nextBlock;
+    }
+}
+
+/*
+    Function to read a version 1 header (array of 100 files at the start of the tar file).
+    The files keep their positions. The space of the old header is used as the index when the header is written again.
+    Returns 1 if read correctly, -1 on error.
+*/
+static int readLegacyHeaderFromTar(struct Star * star, int tarFile){
+    struct LegacyFile legacyFiles[LEGACY_MAX_FILES];
+    ssize_t bytesRead = readFully(star, tarFile, legacyFiles, sizeof(legacyFiles), 0);
+    if (bytesRead < 0)
+        return setError(star, STAR_ERROR_IO, "readHeaderFromTar: Error reading header from tar file: %s.", strerror(errno));
+    else if (bytesRead < sizeof(legacyFiles))
+        return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: It was not possible to read all the header from tar file.");
+    if (ensureHeaderCapacity(star, LEGACY_MAX_FILES) == -1) return -1;
+    for (int i = 0; i < LEGACY_MAX_FILES; i++){
+        if (legacyFiles[i].size == 0 && legacyFiles[i].deleted == 0) continue; // Never used
+        legacyFiles[i].fileName[LEGACY_MAX_FILENAME_LENGTH-1] = '\0';
+        star->header.fileList[i].fileName = storeName(star, legacyFiles[i].fileName);
+        if (star->header.fileList[i].fileName == NULL) return -1;
+        star->header.fileList[i].mode = legacyFiles[i].mode;
+        star->header.fileList[i].size = legacyFiles[i].size;
+        star->header.fileList[i].start = legacyFiles[i].start;
+        star->header.fileList[i].end = legacyFiles[i].end;
+        star->header.fileList[i].deleted = legacyFiles[i].deleted;
+        star->header.fileList[i].originalSize = legacyFiles[i].size;
+        star->header.fileList[i].compressed = 0;
+        star->header.fileList[i].chunked = 0;
+        star->header.numEntries = i + 1;
+    }
+    star->header.bodyStart = sizeof(legacyFiles) + 1; // Version 1 started the content one byte after the header
+    star->header.indexStart = SUPERBLOCK_SIZE;
+    star->header.indexCapacity = star->header.bodyStart - SUPERBLOCK_SIZE;
+    star->header.slotCapacity = LEGACY_MAX_FILES;
+    star->header.oldFormat = 1;
+    if (rebuildNameIndex(star) == -1) return -1;
+    star->header.loaded = 1;
+    return 1;
+}
+
+/*
+    Function to fill a position of the header with an entry of the index.
+    names is the names table of the index, of namesSize bytes. Each name ends with '\0'.
+    Returns -1 if the entry is corrupted.
+*/
+static int setFileFromEntry(struct Star * star, struct File * file, const struct IndexEntry * entry, char * names, off_t namesSize){
+    if ((uint64_t)entry->nameOffset + entry->nameLength >= namesSize ||
+        names[entry->nameOffset + entry->nameLength] != '\0')
+        return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: The index of the tar file is corrupted.");
+    file->fileName = names + entry->nameOffset;
+    file->mode = entry->mode;
+    file->compressed = (entry->flags & ENTRY_COMPRESSED) != 0;
+    file->chunked = (entry->flags & ENTRY_CHUNKED) != 0;
+    file->originalSize = entry->size;
+    file->size = (file->compressed || file->chunked) && entry->size != 0 ? entry->end - entry->start : entry->size; // Bytes stored
+    file->start = entry->start;
+    file->end = entry->end;
+    file->deleted = (entry->flags & ENTRY_DELETED) != 0;
+    file->checksummed = (entry->flags & ENTRY_CHECKSUM) != 0;
+    file->checksum = file->checksummed ? entry->checksum : 0;
+    file->nameOffset = entry->nameOffset;
+    file->dirty = 0;
+    return 0;
+}
+
+/*
+    Function to read an entry of the index from its bytes in the tar file.
+    Before version 4 the entries had no checksum, and they are converted.
+*/
+static void readIndexEntry(struct IndexEntry * entry, const char * bytes, uint32_t version){
+    if (version >= 4){
+        memcpy(entry, bytes, sizeof(*entry));
+        return;
+    }
+    struct LegacyIndexEntry legacyEntry;
+    memcpy(&legacyEntry, bytes, sizeof(legacyEntry));
+    memset(entry, 0, sizeof(*entry));
+    entry->size = legacyEntry.size;
+    entry->start = legacyEntry.start;
+    entry->end = legacyEntry.end;
+    entry->mode = legacyEntry.mode;
+    entry->flags = legacyEntry.flags & ~ENTRY_CHECKSUM;
+    entry->nameOffset = legacyEntry.nameOffset;
+    entry->nameLength = legacyEntry.nameLength;
+}
+
+/*
+    Returns the generation of a superblock, or 0 if it has none (version 1 header, or versions before 3).
+*/
+static uint64_t getGeneration(const struct Superblock * superblock){
+    if (memcmp(superblock->magic, STAR_MAGIC, sizeof(superblock->magic)) != 0 || superblock->version <= MIN_STAR_VERSION)
+        return 0;
+    return superblock->generation;
+}
+
+/*
+    Function to read the generation of the header in the tar file, to know if it changed since it was read (--concurrent).
+    Returns -1 on error.
+*/
+static int readGeneration(struct Star * star, int tarFile, uint64_t * generation){
+    struct Superblock superblock;
+    memset(&superblock, 0, sizeof(superblock));
+    if (readFully(star, tarFile, &superblock, sizeof(superblock), 0) < 0)
+        return setError(star, STAR_ERROR_IO, "readGeneration: Error reading header from tar file: %s.", strerror(errno));
+    *generation = getGeneration(&superblock);
+    return 0;
+}
+
+/*  
+    Function to read the header from the tar file.
+    Receives the indentifier of the tar file from which the header should be read.
+    Reads the superblock and then only the used entries and names of the index.
+    With --mmap, the entries and names are used from the mapping of the tar file instead of being read.
+    With --concurrent the names are read anyway, because the writer can write the index again in the same place.
+    Tar files with the version 1 header are also accepted. Their index, and the index of versions 2 and 3,
+    is written whole in the format of this version the next time it is written.
+    Returns 1 if read correctly, -1 on error.
+    DOES NOT close the tar file.
+*/
+static int readHeaderFromTar(struct Star * star, int tarFile){
+    if (tarFile == -1) return -1;
+    releaseHeader(star);
+    struct Superblock superblock;
+    ssize_t bytesRead = readFully(star, tarFile, &superblock, sizeof(superblock), 0);
+    if (bytesRead < 0)
+        return setError(star, STAR_ERROR_IO, "readHeaderFromTar: Error reading header from tar file: %s.", strerror(errno));
+    else if (bytesRead < sizeof(superblock))
+        return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: It was not possible to read all the header from tar file.");
+    star->header.generation = getGeneration(&superblock);
+    if (memcmp(superblock.magic, STAR_MAGIC, sizeof(superblock.magic)) != 0)
+        return readLegacyHeaderFromTar(star, tarFile);
+    if (superblock.version < MIN_STAR_VERSION || superblock.version > STAR_VERSION)
+        return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: Version %u of the tar file is not supported.", superblock.version);
+    if (superblock.version >= 4 && (superblock.features & FEATURE_STREAMED) && superblock.indexStart == 0){
+        // Written in one pass: the superblock that points to the index is the one at the end
+        if (star->session.size < 2 * SUPERBLOCK_SIZE ||
+            readFully(star, tarFile, &superblock, sizeof(superblock), star->session.size - SUPERBLOCK_SIZE) != sizeof(superblock) ||
+            memcmp(superblock.magic, STAR_MAGIC, sizeof(superblock.magic)) != 0 || superblock.version != STAR_VERSION)
+            return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: The end of the streamed tar file is missing or corrupted.");
+    }
+    if (superblock.version == MIN_STAR_VERSION) // Fields after slotCapacity were not written, they may have old data
+        superblock.features = 0;
+    if (superblock.features & ~KNOWN_FEATURES)
+        return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: The tar file uses features of a newer version.");
+    if (superblock.features & FEATURE_FREE_MAP){
+        star->freeSpace.mapStart = superblock.freeMapStart;
+        star->freeSpace.mapCapacity = superblock.freeMapCapacity;
+        star->freeSpace.mapCount = superblock.numBlankSpaces;
+        star->freeSpace.mapValid = 1;
+    }
+    free(star->dictionary.data);
+    memset(&star->dictionary, 0, sizeof(star->dictionary));
+    if (superblock.features & FEATURE_DICTIONARY){ // Small, read with the header
+        if (superblock.dictionarySize == 0 || superblock.dictionarySize > DICTIONARY_SIZE)
+            return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: The dictionary of the tar file is corrupted.");
+        star->dictionary.data = (unsigned char *)malloc(superblock.dictionarySize);
+        if (star->dictionary.data == NULL)
+            return setError(star, STAR_ERROR_MEMORY, "readHeaderFromTar: Malloc for the dictionary failed.");
+        if (readFully(star, tarFile, star->dictionary.data, superblock.dictionarySize, superblock.dictionaryStart) != (ssize_t)superblock.dictionarySize)
+            return setError(star, STAR_ERROR_IO, "readHeaderFromTar: It was not possible to read the dictionary from tar file.");
+        star->dictionary.start = superblock.dictionaryStart;
+        star->dictionary.size = superblock.dictionarySize;
+    }
+    releaseChunkStore(star);
+    if ((superblock.features & FEATURE_DEDUP) &&
+        readChunkTable(star, tarFile, superblock.chunkTableStart, superblock.chunkTableCapacity, superblock.numChunks) == -1)
+        return -1;
+    size_t entrySize = superblock.version >= 4 ? sizeof(struct IndexEntry) : sizeof(struct LegacyIndexEntry);
+    star->header.indexStart = superblock.indexStart;
+    star->header.indexCapacity = superblock.indexCapacity;
+    star->header.slotCapacity = superblock.slotCapacity * entrySize / sizeof(struct IndexEntry); // Entries of this version that fit
+    star->header.bodyStart = superblock.bodyStart;
+    star->header.oldFormat = superblock.version < STAR_VERSION;
+    star->header.namesSize = superblock.namesSize;
+
+    // Names table, used from the mapping or read in a single block
+    off_t namesStart = superblock.indexStart + (off_t)superblock.slotCapacity * entrySize;
+    int numEntries = superblock.numEntries;
+    const char * map = star->options.readMode == STAR_READ_MMAP && star->options.lockMode == STAR_LOCK_NONE ? mapSession(star) : NULL;
+    if (map != NULL && (namesStart + superblock.namesSize > star->session.mapSize ||
+                        superblock.indexStart + (off_t)numEntries * entrySize > star->session.mapSize))
+        return setError(star, STAR_ERROR_FORMAT, "readHeaderFromTar: The index of the tar file is corrupted.");
+    char * names;
+    if (map != NULL){
+        names = (char *)map + namesStart;
+        star->header.namesMapped = 1;
+    }else{
+        struct NameBlock * block = (struct NameBlock *)malloc(sizeof(struct NameBlock) + superblock.namesSize + 1);
+        if (block == NULL)
+            return setError(star, STAR_ERROR_MEMORY, "readHeaderFromTar: Malloc for names failed.");
+        block->nextBlock = NULL;
+        block->used = block->capacity = superblock.namesSize + 1;
+        block->names[superblock.namesSize] = '\0';
+        star->header.names = block;
+        names = block->names;
+        if (readFully(star, tarFile, names, superblock.namesSize, namesStart) != (ssize_t)superblock.namesSize)
+            return setError(star, STAR_ERROR_IO, "readHeaderFromTar: It was not possible to read the names from tar file.");
+    }
+
+    // Entries, used from the mapping or read in blocks
+    if (ensureHeaderCapacity(star, numEntries) == -1) return -1;
+    struct IndexEntry entry; // The position of the index is not aligned, so every entry is copied
+    if (map != NULL){
+        for (int i = 0; i < numEntries; i++){
+            readIndexEntry(&entry, map + superblock.indexStart + (off_t)i * entrySize, superblock.version);
+            if (setFileFromEntry(star, &star->header.fileList[i], &entry, names, superblock.namesSize) == -1) return -1;
+        }
+    }
+    char entries[COPY_BUFFER_SIZE];
+    int entriesPerBlock = sizeof(entries) / entrySize;
+    for (int first = 0; map == NULL && first < numEntries; first += entriesPerBlock){
+        int amount = numEntries - first;
+        if (amount > entriesPerBlock) amount = entriesPerBlock;
+        size_t bytes = amount * entrySize;
+        if (readFully(star, tarFile, entries, bytes, superblock.indexStart + (off_t)first * entrySize) != (ssize_t)bytes)
+            return setError(star, STAR_ERROR_IO, "readHeaderFromTar: It was not possible to read the index from tar file.");
+        for (int i = 0; i < amount; i++){
+            readIndexEntry(&entry, entries + i * entrySize, superblock.version);
+            if (setFileFromEntry(star, &star->header.fileList[first + i], &entry, names, superblock.namesSize) == -1) return -1;
+        }
+    }
+    star->header.numEntries = numEntries;
+    if (rebuildNameIndex(star) == -1) return -1;
+    star->header.loaded = 1;
+    return 1;
+}
+
+/*
+    Function to make sure the header of the tar file is in memory.
+    The header is read only the first time. After that, the functions that modify it keep it up to date,
+    so the rest of the command does not read it again.
+    Returns -1 on error.
+*/
+static int loadHeader(struct Star * star, const char * tarFileName){
+    if (star->header.loaded) return 0;
+    double startTime = currentSeconds();
+    int result = readHeaderFromTar(star, openSession(star, tarFileName, 0));
+    addPhaseTime(star, STAR_PHASE_LOAD, startTime);
+    if (result != 1){
+        releaseHeader(star); // What was read before the error is not used
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Function to find a file in the tar file.
+    Returns a file struct.
+    If not found, or if the header can not be read, the file returned has size = 0;
+*/
+static struct File findFile(struct Star * star, const char * tarFileName,const char * fileName){
+    struct File notFound;
+    notFound.size=0;
+    if (loadHeader(star, tarFileName) == -1) return notFound;
+    int index = findInNameIndex(star, fileName);
+    if (index != -1) // Encontro el archivo
+        return star->header.fileList[index];
+    setError(star, STAR_ERROR_NOT_FOUND, "findFile: File \"%s\" not found in the tar file.", fileName);
+    return notFound;
+}
+
+/*
+    Function to print the files of the header to the output, with their positions and checksums.
+    Nothing is printed without output.
+*/
+static void printIndex(struct Star * star){
+    FILE * output = star->options.output;
+    if (output == NULL) return;
+    fprintf(output, "\nHEADER: \n");
+    for (int i = 0; i < star->header.numEntries; i++) {
+        if (star->header.fileList[i].size !=  0) {
+            struct File * file = &star->header.fileList[i];
+            fprintf(output, "File name: %s \t Index:%i \t Size: %lld \t Start: %lld \t End: %lld", file->fileName,i, (long long)(file->compressed || file->chunked ? file->originalSize : file->size), (long long)file->start, (long long)file->end);
+            if (file->compressed) // Bytes in the tar file and ratio
+                fprintf(output, " \t Stored: %lld (%.1f%%)", (long long)file->size, 100.0 * file->size / file->originalSize);
+            if (file->chunked)
+                fprintf(output, " \t Chunks: %lld", (long long)(file->size / sizeof(uint32_t)));
+            if (file->checksummed)
+                fprintf(output, " \t CRC32C: %08x", file->checksum);
+            fprintf(output, "\n");
+        }
+    }
+    if (star->dictionary.start != 0) // Written in the tar file
+        fprintf(output, "Dictionary \t Size: %lld \t Start: %lld \t End: %lld\n", (long long)star->dictionary.size,
+               (long long)star->dictionary.start, (long long)(star->dictionary.start + star->dictionary.size));
+    if (star->chunkStore.tableStart != 0 || star->chunkStore.numChunks != 0){ // Different chunks and the bytes they use
+        int numChunks = 0;
+        off_t chunkBytes = 0;
+        for (int i = 0; i < star->chunkStore.numChunks; i++)
+            if (star->chunkStore.chunks[i].size != 0){
+                numChunks++;
+                chunkBytes += star->chunkStore.chunks[i].size;
+            }
+        fprintf(output, "Chunks \t Unique: %d \t Size: %lld\n", numChunks, (long long)chunkBytes);
+    }
+    fprintf(output, "\n");
+}
+
+/*
+    Function to print the header after an operation. Nothing is printed without output or with quietMode.
+*/
+static void printHeader(struct Star * star){
+    if (!star->options.quietMode) printIndex(star);
+}
+
+/*
+    Blank spaces prepared to be written in the free map.
+*/
+struct FreeMapWriter {
+    struct Star * star;
+    int tarFile;
+    struct FreeMapEntry * entries; // Block of COPY_BUFFER_SIZE bytes
+    int entriesInBlock;
+    int entriesWritten;
+};
+
+/*
+    Function to write the blank spaces of the block in the free map.
+    Returns -1 on error.
+*/
+static int flushFreeMap(struct FreeMapWriter * writer){
+    struct Star * star = writer->star;
+    size_t bytes = writer->entriesInBlock * sizeof(struct FreeMapEntry);
+    if (writeFully(star, writer->tarFile, writer->entries, bytes, star->freeSpace.mapStart + (off_t)writer->entriesWritten * sizeof(struct FreeMapEntry)) == -1)
+        return setError(star, STAR_ERROR_IO, "writeHeaderToTar: Error writing free map in tar file: %s.", strerror(errno));
+    writer->entriesWritten += writer->entriesInBlock;
+    writer->entriesInBlock = 0;
+    return 0;
+}
+
+/*
+    Function to add one blank space to the block of the free map. Action of forEachBlankSpace.
+*/
+static int addToFreeMap(struct BlankSpace * blankSpace, void * context){
+    struct FreeMapWriter * writer = (struct FreeMapWriter *)context;
+    writer->entries[writer->entriesInBlock].start = blankSpace->start;
+    writer->entries[writer->entriesInBlock].end = blankSpace->end;
+    if (++writer->entriesInBlock == COPY_BUFFER_SIZE / sizeof(struct FreeMapEntry))
+        return flushFreeMap(writer);
+    return 0;
+}
+
+/*
+    Function to read the blank spaces of the tar file from the free map.
+    Tar files without a free map (older versions) are scanned to calculate them.
+    Returns -1 on error.
+*/
+static int readBlankSpaces(struct Star * star, int tarFile){
+    if (tarFile == -1) return -1;
+    resetBlankSpaceList(star);
+    if (!star->freeSpace.mapValid){
+        if (calculateSpaceBetweenFilesAux(star, star->session.size) == -1) return -1;
+        star->freeSpace.loaded = 1;
+        return 0;
+    }
+    if ((off_t)star->freeSpace.mapCount * sizeof(struct FreeMapEntry) > star->freeSpace.mapCapacity)
+        return setError(star, STAR_ERROR_FORMAT, "loadBlankSpaces: The free map of the tar file is corrupted.");
+    struct FreeMapEntry entries[COPY_BUFFER_SIZE / sizeof(struct FreeMapEntry)];
+    for (int first = 0; first < star->freeSpace.mapCount; first += sizeof(entries) / sizeof(entries[0])){
+        int amount = star->freeSpace.mapCount - first;
+        if (amount > sizeof(entries) / sizeof(entries[0])) amount = sizeof(entries) / sizeof(entries[0]);
+        size_t bytes = amount * sizeof(struct FreeMapEntry);
+        if (readFully(star, tarFile, entries, bytes, star->freeSpace.mapStart + (off_t)first * sizeof(struct FreeMapEntry)) != (ssize_t)bytes){
+            resetBlankSpaceList(star);
+            return setError(star, STAR_ERROR_IO, "loadBlankSpaces: It was not possible to read the free map from tar file.");
+        }
+        for (int i = 0; i < amount; i++){
+            if (entries[i].start > entries[i].end){
+                resetBlankSpaceList(star);
+                return setError(star, STAR_ERROR_FORMAT, "loadBlankSpaces: The free map of the tar file is corrupted.");
+            }
+            if (addBlankSpace(star, entries[i].start, entries[i].end) == -1){
+                resetBlankSpaceList(star);
+                return -1;
+            }
+        }
+    }
+    star->freeSpace.loaded = 1;
+    return 0;
+}
+
+/*
+    Function to load the blank spaces of the tar file, only if they are not in memory yet (readBlankSpaces).
+    The header must be loaded.
+    Returns -1 on error.
+*/
+static int loadBlankSpaces(struct Star * star, int tarFile){
+    if (star->freeSpace.loaded) return 0;
+    double startTime = currentSeconds();
+    int result = readBlankSpaces(star, tarFile);
+    addPhaseTime(star, STAR_PHASE_LOAD, startTime);
+    return result;
+}
+
+/*
+    Function to move the index to a new block with space for twice its entries and names.
+    Called when the index does not fit in its block anymore.
+    The old block is left as blank space, and the new one is placed in the best blank space or at the end of the content.
+    Returns -1 on error.
+*/
+static int moveIndex(struct Star * star, off_t namesSize){
+    int slots = star->header.numEntries * 2;
+    if (slots < MIN_INDEX_SLOTS) slots = MIN_INDEX_SLOTS;
+    off_t namesCapacity = namesSize * 2;
+    if (namesCapacity < MIN_NAMES_CAPACITY) namesCapacity = MIN_NAMES_CAPACITY;
+
+    if (addBlankSpace(star, star->header.indexStart, star->header.indexStart + star->header.indexCapacity) == -1) return -1;
+    star->header.indexCapacity = 0; // The old block is not used anymore
+    star->header.slotCapacity = slots;
+    off_t indexCapacity = (off_t)slots * sizeof(struct IndexEntry) + namesCapacity;
+    star->header.indexStart = allocateSpace(star, indexCapacity);
+    if (star->header.indexStart == -1) return -1;
+    star->header.indexCapacity = indexCapacity;
+    report(star, "Index moved to position %lld.\n", (long long)star->header.indexStart);
+    return 0;
+}
+
+/*
+    Function to write the blank spaces in the free map of the tar file.
+    If they do not fit in its block, the free map is moved to a new block with space for twice of them.
+    Returns -1 on error.
+*/
+static int writeFreeMapToTar(struct Star * star, int tarFile){
+    while ((off_t)star->freeSpace.numBlankSpaces * sizeof(struct FreeMapEntry) > star->freeSpace.mapCapacity){
+        if (addBlankSpace(star, star->freeSpace.mapStart, star->freeSpace.mapStart + star->freeSpace.mapCapacity) == -1) return -1;
+        star->freeSpace.mapStart = 0;
+        star->freeSpace.mapCapacity = 0;
+        off_t mapCapacity = (off_t)(star->freeSpace.numBlankSpaces + 2) * 2 * sizeof(struct FreeMapEntry); // Moving it can add blank spaces
+        if (mapCapacity < MIN_FREE_MAP_CAPACITY) mapCapacity = MIN_FREE_MAP_CAPACITY;
+        star->freeSpace.mapStart = allocateSpace(star, mapCapacity);
+        if (star->freeSpace.mapStart == -1) return -1;
+        star->freeSpace.mapCapacity = mapCapacity;
+    }
+
+    struct FreeMapEntry entries[COPY_BUFFER_SIZE / sizeof(struct FreeMapEntry)];
+    struct FreeMapWriter writer = {star, tarFile, entries, 0, 0};
+    if (forEachBlankSpace(star->freeSpace.root[BY_START], addToFreeMap, &writer) == -1 || flushFreeMap(&writer) == -1)
+        return -1;
+    star->freeSpace.mapCount = star->freeSpace.numBlankSpaces;
+    star->freeSpace.mapValid = 1;
+    return 0;
+}
+
+/*
+    Function to fill the entry of the index of a file. nameOffset is the position of its name in the names table.
+*/
+static void fillIndexEntry(struct IndexEntry * entry, const struct File * file, off_t nameOffset){
+    memset(entry, 0, sizeof(*entry));
+    entry->size = (file->compressed || file->chunked) && file->size != 0 ? file->originalSize : file->size;
+    entry->start = file->start;
+    entry->end = file->end;
+    entry->mode = file->mode;
+    entry->flags = (file->deleted ? ENTRY_DELETED : 0) | (file->compressed ? ENTRY_COMPRESSED : 0) | (file->chunked ? ENTRY_CHUNKED : 0) |
+                   (file->checksummed ? ENTRY_CHECKSUM : 0);
+    entry->checksum = file->checksum;
+    entry->nameOffset = nameOffset;
+    entry->nameLength = file->fileName != NULL ? strlen(file->fileName) : 0;
+}
+
+/*
+    Function to write the names of the block in the names table.
+    Returns -1 on error.
+*/
+static int flushNames(struct NamesWriter * writer){
+    if (writeFully(writer->star, writer->tarFile, writer->block, writer->namesInBlock, writer->namesStart + writer->namesWritten) == -1)
+        return setError(writer->star, STAR_ERROR_IO, "writeIndexToTar: Error writing index in tar file: %s.", strerror(errno));
+    writer->namesWritten += writer->namesInBlock;
+    writer->namesInBlock = 0;
+    return 0;
+}
+
+/*
+    Function to add a name, with its '\0', after the last one of the names table.
+    Returns its position in the names table, or -1 on error.
 */
-void listStar(const char * tarFileName) {
-    int tarFile = openFile(tarFileName,0);
-    if (tarFile == -1) {
-        fprintf(stderr, "listStar: Error opening tar file.\n");
-        exit(1);
+static off_t addName(struct NamesWriter * writer, const char * fileName){
+    if (fileName == NULL) fileName = "";
+    size_t length = strlen(fileName) + 1;
+    if (writer->namesInBlock + length > sizeof(writer->block) && flushNames(writer) == -1) // Writes the names of the block
+        return -1;
+    off_t nameOffset = writer->namesWritten + writer->namesInBlock;
+    if (length > sizeof(writer->block)){ // Name bigger than the block, written directly
+        if (writeFully(writer->star, writer->tarFile, fileName, length, writer->namesStart + nameOffset) == -1)
+            return setError(writer->star, STAR_ERROR_IO, "writeIndexToTar: Error writing index in tar file: %s.", strerror(errno));
+        writer->namesWritten += length;
+    }else{
+        memcpy(writer->block + writer->namesInBlock, fileName, length);
+        writer->namesInBlock += length;
     }
-    if (readHeaderFromTar(tarFile)!=1){
-        printf("listStar: Error reading the header from tar file.\n");
-        exit(1);
+    return nameOffset;
+}
+
+/*
+    Function to write 'amount' entries of the index, that go one after the other from the position 'first'.
+    Returns -1 on error.
+*/
+static int writeEntriesToTar(struct Star * star, int tarFile, const struct IndexEntry * entries, int amount, int first){
+    size_t bytes = amount * sizeof(struct IndexEntry);
+    if (writeFully(star, tarFile, entries, bytes, star->header.indexStart + (off_t)first * sizeof(struct IndexEntry)) == -1)
+        return setError(star, STAR_ERROR_IO, "writeIndexToTar: Error writing index in tar file: %s.", strerror(errno));
+    return 0;
+}
+
+/*
+    Function to forget the changed entries, after they are written.
+*/
+static void clearDirtyEntries(struct Star * star){
+    for (int i = 0; i < star->header.numDirty; i++)
+        star->header.fileList[star->header.dirtyEntries[i]].dirty = 0;
+    star->header.numDirty = 0;
+}
+
+/*
+    Function to write all the used entries and names of the index in its block of the tar file.
+    The names table is written again without the old names of reused positions.
+    The index must fit in its block.
+    Returns -1 on error.
+*/
+static int writeIndexToTar(struct Star * star, int tarFile){
+    // Entries and names are prepared in blocks and written when the block is full
+    struct IndexEntry entries[COPY_BUFFER_SIZE / sizeof(struct IndexEntry)];
+    struct NamesWriter * names = &star->namesWriter; // Too big for the stack of the threads
+    names->star = star;
+    names->tarFile = tarFile;
+    names->namesStart = star->header.indexStart + (off_t)star->header.slotCapacity * sizeof(struct IndexEntry);
+    names->namesInBlock = 0;
+    names->namesWritten = 0;
+    int entriesInBlock = 0, entriesWritten = 0;
+    for (int i = 0; i < star->header.numEntries; i++){
+        struct File * file = &star->header.fileList[i];
+        if ((file->nameOffset = addName(names, file->fileName)) == -1) return -1;
+        fillIndexEntry(&entries[entriesInBlock++], file, file->nameOffset);
+        if (entriesInBlock == sizeof(entries) / sizeof(entries[0]) || i == star->header.numEntries - 1){ // Writes the entries of the block
+            if (writeEntriesToTar(star, tarFile, entries, entriesInBlock, entriesWritten) == -1) return -1;
+            entriesWritten += entriesInBlock;
+            entriesInBlock = 0;
+        }
     }
-    printf("\nLIST TAR FILES\n");
-    printHeader();
-    close(tarFile);
+    if (flushNames(names) == -1) return -1;
+    star->header.namesSize = names->namesWritten;
+    clearDirtyEntries(star);
+    return 0;
 }
 
 /*
-    Function that finds an available blank space to place a new file.
-    sizeOfNewFile is the size of the new file.
-    Returns the found blank space.
-    Returns NULL if there are no blank spaces with enough size.
+    Function to compare two positions of the header. Used to sort them with qsort.
+*/
+static int compareIndexes(const void * first, const void * second){
+    return (*(const int *)first > *(const int *)second) - (*(const int *)first < *(const int *)second);
+}
+
+/*
+    Function to write only the entries of the index that changed since it was written.
+    The names of the new files are added after the last name of the names table, the rest of the names are not touched.
+    Entries that go one after the other are written together.
+    The index must fit in its block, with the new names.
+    Returns -1 on error.
+*/
+static int writeDirtyEntriesToTar(struct Star * star, int tarFile){
+    struct IndexEntry entries[COPY_BUFFER_SIZE / sizeof(struct IndexEntry)];
+    struct NamesWriter * names = &star->namesWriter; // Too big for the stack of the threads
+    names->star = star;
+    names->tarFile = tarFile;
+    names->namesStart = star->header.indexStart + (off_t)star->header.slotCapacity * sizeof(struct IndexEntry);
+    names->namesInBlock = 0;
+    names->namesWritten = star->header.namesSize;
+    qsort(star->header.dirtyEntries, star->header.numDirty, sizeof(int), compareIndexes);
+    int entriesInBlock = 0, firstInBlock = 0;
+    for (int i = 0; i < star->header.numDirty; i++){
+        int index = star->header.dirtyEntries[i];
+        struct File * file = &star->header.fileList[index];
+        if (entriesInBlock > 0 && (index != firstInBlock + entriesInBlock || entriesInBlock == sizeof(entries) / sizeof(entries[0]))){
+            if (writeEntriesToTar(star, tarFile, entries, entriesInBlock, firstInBlock) == -1) return -1;
+            entriesInBlock = 0;
+        }
+        if (entriesInBlock == 0) firstInBlock = index;
+        if (file->nameOffset == -1 && (file->nameOffset = addName(names, file->fileName)) == -1)
+            return -1;
+        fillIndexEntry(&entries[entriesInBlock++], file, file->nameOffset);
+    }
+    if (entriesInBlock > 0 && writeEntriesToTar(star, tarFile, entries, entriesInBlock, firstInBlock) == -1)
+        return -1;
+    if (flushNames(names) == -1) return -1;
+    star->header.namesSize = names->namesWritten;
+    clearDirtyEntries(star);
+    return 0;
+}
+
+/*
+    Function to fill the superblock of the tar file with the header. The bytes of the block after the fields are zeros.
+    features are added to the ones of the header.
+*/
+static void buildSuperblock(struct Star * star, char block[SUPERBLOCK_SIZE], uint32_t features){
+    struct Superblock superblock;
+    memset(&superblock, 0, sizeof(superblock));
+    memcpy(superblock.magic, STAR_MAGIC, sizeof(superblock.magic));
+    superblock.version = STAR_VERSION;
+    superblock.indexStart = star->header.indexStart;
+    superblock.indexCapacity = star->header.indexCapacity;
+    superblock.namesSize = star->header.namesSize;
+    superblock.bodyStart = star->header.bodyStart;
+    superblock.numEntries = star->header.numEntries;
+    superblock.slotCapacity = star->header.slotCapacity;
+    superblock.generation = star->header.generation;
+    superblock.features = features | (star->freeSpace.mapValid ? FEATURE_FREE_MAP : 0);
+    for (int i = 0; i < star->header.numEntries; i++)
+        if (star->header.fileList[i].size != 0 && star->header.fileList[i].compressed)
+            superblock.features |= FEATURE_COMPRESSION;
+    superblock.numBlankSpaces = star->freeSpace.mapCount;
+    superblock.freeMapStart = star->freeSpace.mapStart;
+    superblock.freeMapCapacity = star->freeSpace.mapCapacity;
+    if (star->dictionary.start != 0){
+        superblock.features |= FEATURE_DICTIONARY;
+        superblock.dictionaryStart = star->dictionary.start;
+        superblock.dictionarySize = star->dictionary.size;
+    }
+    if (star->chunkStore.tableStart != 0){
+        superblock.features |= FEATURE_DEDUP;
+        superblock.chunkTableStart = star->chunkStore.tableStart;
+        superblock.chunkTableCapacity = star->chunkStore.tableCapacity;
+        superblock.numChunks = star->chunkStore.numChunks;
+    }
+    memset(block, 0, SUPERBLOCK_SIZE);
+    memcpy(block, &superblock, sizeof(superblock));
+}
+
+/*
+    Function to write the superblock in the tar file. It points to the index, the free map, the dictionary
+    and the chunk table, so it is written after them.
+    Returns -1 on error.
+*/
+static int writeSuperblockToTar(struct Star * star, int tarFile){
+    char block[SUPERBLOCK_SIZE];
+    buildSuperblock(star, block, 0);
+    if (writeFully(star, tarFile, block, sizeof(block), 0) == -1) // Superblock last, it points to the index
+        return setError(star, STAR_ERROR_IO, "writeSuperblockToTar: Error writing superblock in tar file: %s.", strerror(errno));
+    return 0;
+}
+
+/*  
+    Function to write the header in the tar file.
+    tarFile is the indiciator of the tar file. Must be opened in writing mode.
+    Writes the entries and names of the index that changed, the chunk table, the free map, and then the superblock.
+    The whole index is written again only if it has an older format, or if the entries or the new names
+    do not fit in its block. If it still does not fit without the old names, it is moved first.
+    Returns -1 on error.
+*/
+static int writeHeaderToTar(struct Star * star, int tarFile){
+    report(star, "Writing header to tar...\n");
+    if (loadBlankSpaces(star, tarFile) == -1) return -1; // The free map is written again
+    off_t namesCapacity = star->header.indexCapacity - (off_t)star->header.slotCapacity * sizeof(struct IndexEntry);
+    off_t newNamesSize = star->header.namesSize;
+    for (int i = 0; i < star->header.numDirty; i++){
+        struct File * file = &star->header.fileList[star->header.dirtyEntries[i]];
+        if (file->nameOffset == -1) newNamesSize += (file->fileName != NULL ? strlen(file->fileName) : 0) + 1;
+    }
+    if (!star->header.oldFormat && star->header.numEntries <= star->header.slotCapacity && newNamesSize <= namesCapacity && newNamesSize <= UINT32_MAX){
+        if (writeDirtyEntriesToTar(star, tarFile) == -1) return -1;
+    }else{
+        off_t namesSize = getNamesSize(star);
+        if (namesSize > UINT32_MAX)
+            return setError(star, STAR_ERROR_ARGUMENT, "writeHeaderToTar: The names of the files are too big.");
+        if ((star->header.numEntries > star->header.slotCapacity || namesSize > namesCapacity) && moveIndex(star, namesSize) == -1)
+            return -1;
+        if (writeIndexToTar(star, tarFile) == -1) return -1;
+    }
+    if (writeChunkTableToTar(star, tarFile) == -1 ||
+        writeFreeMapToTar(star, tarFile) == -1) // After the index and the chunk table, moving them changes the blank spaces
+        return -1;
+    star->header.generation++; // The readers that had the header read it again
+    if (writeSuperblockToTar(star, tarFile) == -1) return -1;
+    star->header.oldFormat = 0;
+    return 0;
+}
+
+/*
+    Function to write the header in the tar file (writeHeaderToTar), counted in starStats as a flush.
+    The blank spaces it loads first are counted in their own phase.
+    Returns -1 on error.
+*/
+static int flushHeader(struct Star * star, int tarFile){
+    double startTime = currentSeconds();
+    double loadSeconds = star->stats.phaseSeconds[STAR_PHASE_LOAD];
+    int result = writeHeaderToTar(star, tarFile);
+    star->stats.phaseSeconds[STAR_PHASE_FLUSH] += currentSeconds() - startTime - (star->stats.phaseSeconds[STAR_PHASE_LOAD] - loadSeconds);
+    star->stats.headerFlushes++;
+    return result;
+}
+
+/*
+    Function to close the session with the tar file.
+    If the header was modified, it is written once here. The writer of --concurrent takes the lock of the header first,
+    and closing the tar file releases all its locks, so its changes are seen by the readers all at once.
+    Updates the size of the session with the final size of the tar file.
+    The tar file is closed even if the header can not be written. Returns -1 in that case.
 */
-struct BlankSpace * findBlankSpaceForNewFile(off_t sizeOfNewFile){
-    struct BlankSpace * current = firstBlankSpace;
-    off_t spaceSize;
-    while (current != NULL) {
-        spaceSize = current->end - current->start;
-        if (spaceSize >= sizeOfNewFile)
-            return current;
-        current = current->nextBlankSpace;
+static int closeSession(struct Star * star){
+    if (star->session.tarFile == -1) return 0;
+    int result = 0;
+    if (star->session.dirty){
+        if (star->session.writer) // The readers do not read the header while it is written
+            result = lockRange(star, star->session.tarFile, LOCK_HEADER_POSITION, 1, F_WRLCK, 1);
+        if (result == 0)
+            result = flushHeader(star, star->session.tarFile);
+        star->session.dirty = 0;
     }
-    return NULL; 
+    struct stat tarStat;
+    if (fstat(star->session.tarFile, &tarStat) == 0)
+        star->session.size = tarStat.st_size;
+    if (star->session.map != NULL){
+        munmap((void *)star->session.map, star->session.mapSize);
+        star->session.map = NULL;
+    }
+    close(star->session.tarFile); // Releases the locks
+    star->session.tarFile = -1;
+    star->session.writer = 0;
+    star->session.pinned = 0;
+    return result;
+}
+
+/*
+    Information shared by the threads that write the body of the tar file.
+*/
+struct BodyWork {
+    struct Star * star;
+    int tarFile;
+    const char ** fileNames;
+    int * indexes; // Position in the header of each file. NULL if it is the same as in fileNames
+    int spool; // Temporary file with the compressed files. -1 if they are read from their own files
+    off_t * spoolStarts; // Position of each file in the spool
+    unsigned char * written; // 1 for the files already written in batches (moveSmallMembers). NULL if none
+};
+
+/*
+    Function to calculate the checksum of the bytes stored for a file in the tar file.
+    They are read from the mapping of the tar file if it is mapped, otherwise with system calls, a block at a time.
+    Right after they were written they are still in the page cache, so nothing is read from the disk.
+    Returns -1 if they can not be read.
+*/
+static int checksumStoredContent(struct Star * star, int tarFile, struct File file, uint32_t * checksum){
+    const char * map = star->options.readMode == STAR_READ_MMAP ? mapSession(star) : NULL;
+    *checksum = 0;
+    if (map != NULL && file.end <= star->session.mapSize){
+        *checksum = updateChecksum(0, map + file.start, file.size);
+        return 0;
+    }
+    char buffer[COPY_BUFFER_SIZE];
+    for (off_t position = file.start; position < file.end; position += COPY_BUFFER_SIZE){
+        size_t blockSize = file.end - position < COPY_BUFFER_SIZE ? (size_t)(file.end - position) : COPY_BUFFER_SIZE;
+        if (readFully(star, tarFile, buffer, blockSize, position) != (ssize_t)blockSize)
+            return -1;
+        *checksum = updateChecksum(*checksum, buffer, blockSize);
+    }
+    return 0;
+}
+
+/*
+    Function that writes the content of one file in its position of the tar file. Job of runInParallel used by writeBodyToTar.
+    index is the position of the file in fileNames, which is the same position it has in the header.
+    context is a BodyWork. The tar file is shared by all the threads, so it is only written with positions.
+    The content is moved by the kernel when possible (copyContent), and then it has no checksum unless verifyMode asks
+    for it: it is calculated from the tar file afterwards. With --buffered the bytes go through the buffer anyway,
+    so the checksum is calculated while they are copied. It is saved in the position of the file in the header.
+    Returns -1 on error.
+*/
+static int writeFileJob(int index, void * context){
+    struct BodyWork * work = (struct BodyWork *)context;
+    struct Star * star = work->star;
+    struct File * headerFile = &star->header.fileList[work->indexes != NULL ? work->indexes[index] : index];
+    struct File fileInfo = *headerFile;
+    if (work->written != NULL && work->written[index]) return 0;
+    int file = work->spool;
+    off_t position = 0;
+    if (file != -1) // Compressed
+        position = work->spoolStarts[index];
+    else if ((file = open(work->fileNames[index], O_RDONLY)) == -1)
+        return setError(star, STAR_ERROR_IO, "writeBodyToTar: Error opening \"%s\": %s.", work->fileNames[index], strerror(errno));
+    int buffered = star->options.transferMode == STAR_TRANSFER_BUFFERED;
+    int result = buffered ? copyContentWithChecksum(star, file, position, work->tarFile, fileInfo.start, fileInfo.size, &headerFile->checksum) :
+                            copyContent(star, file, position, work->tarFile, fileInfo.start, fileInfo.size); // Copies content to its position in the tar file
+    if (file != work->spool) close(file);
+    if (result == -1)
+        return setError(star, STAR_ERROR_IO, "writeBodyToTar: Error writing \"%s\" on tar file.", work->fileNames[index]);
+    if (!buffered && star->options.verifyMode &&
+        checksumStoredContent(star, work->tarFile, fileInfo, &headerFile->checksum) == -1)
+        return setError(star, STAR_ERROR_IO, "writeBodyToTar: Error reading \"%s\" from tar file to calculate its checksum.", work->fileNames[index]);
+    headerFile->checksummed = buffered || star->options.verifyMode;
+    return 0;
+}
+
+/*
+    Function to write the content of the files in their positions of the tar file, by numThreads threads (writeFileJob).
+    The small files that are not in the spool are written first in batches (moveSmallMembers),
+    and the threads only write the rest.
+    Returns -1 on error.
+*/
+static int writeFiles(struct Star * star, struct BodyWork * work, int numFiles){
+    struct MemberTransfer * transfers = NULL;
+    if (work->spool == -1){
+        transfers = (struct MemberTransfer *)malloc(numFiles * sizeof(struct MemberTransfer));
+        work->written = (unsigned char *)calloc(numFiles, 1);
+    }
+    if (transfers != NULL && work->written != NULL){ // Otherwise all the files are written by the threads
+        int numTransfers = 0;
+        for (int i = 0; i < numFiles; i++){
+            struct File * file = &star->header.fileList[work->indexes != NULL ? work->indexes[i] : i];
+            if (file->size == 0 || file->size > SMALL_MEMBER_LIMIT) continue;
+            struct MemberTransfer transfer = {.fileName = work->fileNames[i], .fromNamed = 1, .toPosition = file->start, .size = file->size, .job = i};
+            transfers[numTransfers++] = transfer;
+        }
+        moveSmallMembers(star, work->tarFile, transfers, numTransfers);
+        for (int i = 0; i < numTransfers; i++){
+            if (transfers[i].moved != RING_MOVED) continue;
+            struct File * file = &star->header.fileList[work->indexes != NULL ? work->indexes[transfers[i].job] : transfers[i].job];
+            file->checksum = transfers[i].checksum;
+            file->checksummed = 1;
+            work->written[transfers[i].job] = 1;
+        }
+    }
+    int result = runInParallel(star, numFiles, star->options.numThreads, writeFileJob, work);
+    free(transfers);
+    free(work->written);
+    work->written = NULL;
+    return result;
+}
+
+/*
+    Function to write the content of the files stored in header into the tar files.
+    The positions of every file were already calculated by createHeader, so the files are written
+    at the same time by numThreads threads, each one in its own range of the tar file.
+    tarFile is the identifier of the tar file. Must be opened in writing mode.
+    fileNames is an array with the names of all the files to be written, in the same order as the header.
+    numFiles is the ammount of files to be written.
+    Returns -1 on error.
+*/
+static int writeBodyToTar(struct Star * star, int tarFile,const char * fileNames[],int numFiles, int spool, off_t * spoolStarts){
+    report(star, "Writing body to tar...\n");
+    if (tarFile == -1) return -1;
+    if (ftruncate(tarFile, getEndOfContent(star)) == -1) // Final size, so the threads do not extend the file
+        return setError(star, STAR_ERROR_IO, "writeBodyToTar: Error changing the size of the tar file: %s.", strerror(errno));
+    growSession(star, getEndOfContent(star));
+    struct BodyWork work = {star, tarFile, fileNames, NULL, spool, spoolStarts, NULL};
+    double startTime = currentSeconds();
+    if (writeFiles(star, &work, numFiles) == -1) return -1;
+    double elapsed = currentSeconds() - startTime;
+
+    off_t totalBytes = getSizeOfContents(star);
+    report(star, "Written %lld bytes in %.3f seconds with %d thread(s): %.2f MB/s\n", (long long)totalBytes, elapsed, star->options.numThreads,
+                 elapsed > 0 ? totalBytes / elapsed / (1024 * 1024) : 0.0);
+    return 0;
+}
+
+/*
+    Function in charge of writing the body of tar file.
+    tarFileName is the name of the tar file.
+    fileNames is an array with the names of all the files to be written.
+    numFiles is the ammount of files to be written.
+    Returns -1 on error.
+*/
+static int createBody(struct Star * star, const char * tarFileName, const char *fileNames[],int numFiles, int spool, off_t * spoolStarts){
+    if (loadHeader(star, tarFileName) == -1) return -1; // Already in memory after createHeader
+    return writeBodyToTar(star, openSession(star, tarFileName,0), fileNames,numFiles, spool, spoolStarts);
+}
+
+/*
+    Function to create the tar file header.
+    numFiles is the ammount of files to be written.
+    files is an array with the information of all the files to be packaged (prepareFiles).
+*/
+static int createHeader(struct Star * star, int numFiles, struct File * files){
+    report(star, "\nCREATE HEADER\n");
+    off_t currentPosition = 0; // End of the last file added
+    off_t namesSize = 0;
+    for (int i=0; i < numFiles; i++)
+        namesSize += strlen(files[i].fileName) + 1;
+    releaseHeader(star);
+    placeIndexAtStart(star, numFiles, namesSize); // The files start after the index
+    struct File newFile; // File to be added
+    for (int i=0; i < numFiles; i++){
+        newFile = files[i]; // Info of the file, with the size it has in the tar file
+        if (currentPosition==0) // First file
+            newFile.start = currentPosition = star->header.bodyStart;
+        else
+            newFile.start = currentPosition;
+        newFile.end = currentPosition = newFile.start + newFile.size;
+        report(star, "Adding \"%s\" to header's file list.\n", newFile.fileName);
+        if (addFileToHeaderListInLastPosition(star, newFile) == -1) return -1; // Update header. Position i, the same as in fileNames
+    }
+    star->header.loaded = 1;
+    star->freeSpace.loaded = 1; // No blank spaces, the files are together
+    return markHeaderDirty(star); // Written when the session is closed, after the body
+}
+
+/*
+    Functino that creates a tar file with the selected files.
+    fileNames is an array with all the files to be added in the tar file.
+    tarFileName is the name of the tar file.
+    numFiles is the ammount of files that will be created.
+    Returns -1 on error.
+*/
+static int createStar(struct Star * star, int numFiles, const char *tarFileName, const char *fileNames[]){
+    report(star, "\nCREATE TAR FILE\n");
+    struct File * files = (struct File *)malloc(numFiles * sizeof(struct File));
+    off_t * spoolStarts = (off_t *)malloc(numFiles * sizeof(off_t));
+    if (files == NULL || spoolStarts == NULL){
+        free(files);
+        free(spoolStarts);
+        return setError(star, STAR_ERROR_MEMORY, "createStar: Malloc for the files failed.");
+    }
+    int result = -1;
+    int spool = prepareFiles(star, numFiles, fileNames, files, spoolStarts); // Compressed if --compress
+    if (spool != -2 && openSession(star, tarFileName,1) != -1 && createHeader(star, numFiles,files) != -1){ // Created empty
+        report(star, "Size of header: %lld\n", (long long)star->header.bodyStart);
+        printHeader(star);
+        if (createBody(star, tarFileName,fileNames,numFiles,spool,spoolStarts) != -1)
+            result = storeDictionary(star, star->session.tarFile); // After the files
+    }
+    if (spool >= 0) close(spool);
+    free(files);
+    free(spoolStarts);
+    return result;
+}
+
+/*
+    Function to load the blank spaces of the tar file.
+    They are only read once per command, and then kept updated in memory.
+    They are not printed here: the operation prints them once it changed them.
+    Returns -1 on error.
+*/
+static int calculateBlankSpaces(struct Star * star, const char * tarFileName){
+    report(star, "Calculating blank spaces...\n");
+    if (loadHeader(star, tarFileName) == -1 || loadBlankSpaces(star, openSession(star, tarFileName, 0)) == -1)
+        return -1;
+    return 0;
+}
+
+/*
+    Function to delete a file from header.
+    file is the file to be deleted.
+    Returns 1 if deleted successfully, 0 if it is not in the header and -1 on error.
+*/
+static int deleteFileFromHeader(struct Star * star, struct File file){
+    report(star, "Deleting file from header...\n");
+    int i = findInNameIndex(star, file.fileName);
+    if (i == -1) return 0;
+    removeFromNameIndex(star, i);
+    star->header.fileList[i].size=0;
+    star->header.fileList[i].deleted=1; // Used to not mix the blank spaces
+    star->header.fileList[i].originalSize=0;
+    star->header.fileList[i].compressed=0;
+    star->header.fileList[i].chunked=0;
+    star->header.fileList[i].checksummed=0;
+    if (markEntryDirty(star, i) == -1) return -1; // Its name stays in the names table
+    return 1;
 }
 
-/* 
-    Function to write content at the end of the tar file.
+/*
+    Function to eliminate the content of a file from the body of the tar file.
+    A hole is punched in the range, so the file system frees its blocks without writing it.
+    Only if the file system does not support holes, the range is filled with zeros.
     tarFileName is the name of the tar file.
-    fileName is the name of the file to be added.
-*/
-void writeAtTheEndOfTar(const char * tarFileName ,const char * fileName){
-    int tarFile = openFile(tarFileName,0);
-    int file = openFile(fileName,0);
-    struct stat fileStat;
-    if (lstat(fileName, &fileStat) == -1) { // Get info from file to be added.
-        perror("append: Error al obtener información del archivo.\n");
-        exit(1);
-    }
-    struct File fileInfo;
-    struct File lastFile = findLastFileInHeader();
+    fileToBeDeleted is the file to be deleted.
+    DOES NOT modify the size of the tar file.
+    Returns -1 on error.
+*/
+static int deleteFileContentFromBody(struct Star * star, const char* tarFileName,struct File fileToBeDeleted) {
+    report(star, "Deleting file from body...\n");
+    int tarFile = openSession(star, tarFileName, 0);
+    if (tarFile == -1) return -1;
+    off_t rangeSize = fileToBeDeleted.end - fileToBeDeleted.start; // 'end' is the first position after the file
+    off_t position = fileToBeDeleted.start;
+    if (lockContent(star, position, fileToBeDeleted.end) == -1) return -1; // Its readers finish first
+    if (fallocate(tarFile, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, rangeSize) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP && errno != ENOSYS)
+        return setError(star, STAR_ERROR_IO, "deleteFileContentFromBody: Error punching a hole in tar file: %s.", strerror(errno));
+
+    // Fills the range with null characters
+    char buffer[COPY_BUFFER_SIZE]; // Default writing size
+    memset(buffer, 0, sizeof(buffer));
     
-    // Fill info of file in fileInfo
-    strncpy(fileInfo.fileName,fileName,MAX_FILENAME_LENGTH);
-    fileInfo.mode = fileStat.st_mode; 
-    fileInfo.size = fileStat.st_size;
-    fileInfo.start = lastFile.end;  
-    fileInfo.end = lastFile.end+ fileStat.st_size;
-    fileInfo.deleted = 0; 
-
-    addFileToHeaderListInLastPosition(fileInfo); // adds file to header
-    writeHeaderToTar(tarFile); // Re-writes header in tar file.
-
-    char buffer[fileInfo.size]; // Buffer to save the content of the file to be saved
-    read(file,buffer, sizeof(buffer)); // Saves content file in buffer
-    lseek(tarFile, fileInfo.start, SEEK_SET); // Sets pointer to the beginning of the tar file
-    if (write(tarFile, buffer, sizeof(buffer)) == -1) {
-        perror("writeFileContentToTar: Error writing in the file.");
-        close(tarFile);
-        exit(1);
+    // Makes sure to delete all the content although the size of the buffer
+    while (rangeSize > 0) {
+        size_t bytesToWrite = rangeSize < sizeof(buffer) ? rangeSize : sizeof(buffer);
+        if (writeFully(star, tarFile, buffer, bytesToWrite, position) == -1)
+            return setError(star, STAR_ERROR_IO, "deleteFileContentFromBody: Error writing in tar file: %s.", strerror(errno));
+        rangeSize -= bytesToWrite;
+        position += bytesToWrite;
+    }
+    return 0;
+}
+
+/*
+    Function to remove a reference to every chunk of a deduplicated file.
+    The chunks that are not in any other file are deleted like a file, and their space is a blank space.
+    Returns -1 on error.
+*/
+static int deleteChunks(struct Star * star, const char * tarFileName, struct File file){
+    int tarFile = openSession(star, tarFileName, 0);
+    if (loadBlankSpaces(star, tarFile) == -1) return -1;
+    int numChunks = file.size / sizeof(uint32_t);
+    uint32_t * chunkIds = (uint32_t *)malloc(file.size);
+    if (chunkIds == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "deleteChunks: Malloc for the list of chunks failed.");
+    int failed = 0;
+    if (readFully(star, tarFile, chunkIds, file.size, file.start) != (ssize_t)file.size)
+        failed = setError(star, STAR_ERROR_IO, "deleteChunks: Error reading the list of chunks from tar file.");
+    for (int i = 0; i < numChunks && !failed; i++){
+        if (chunkIds[i] >= (uint32_t)star->chunkStore.numChunks || star->chunkStore.chunks[chunkIds[i]].references == 0){
+            failed = setError(star, STAR_ERROR_FORMAT, "deleteChunks: The list of chunks of \"%s\" is corrupted.", file.fileName);
+            break;
+        }
+        struct ChunkEntry * chunk = &star->chunkStore.chunks[chunkIds[i]];
+        if (--chunk->references > 0) continue; // Still in other files
+        struct File chunkContent = {.size = chunk->size, .start = chunk->start, .end = chunk->start + chunk->size};
+        if ((star->options.deleteMode == STAR_DELETE_PUNCH && deleteFileContentFromBody(star, tarFileName, chunkContent) == -1) ||
+            addBlankSpace(star, chunkContent.start, chunkContent.end) == -1)
+            failed = -1;
+        removeChunk(star, chunkIds[i]);
+    }
+    free(chunkIds);
+    if (failed) return -1;
+    return rebuildChunkIndex(star); // Without the removed chunks, and with the new end of the chunks
+}
+
+/*
+    Function in charge to delete a file from the tar file.
+    tarFileName is the name of the tar file.
+    fileNameTobeDeleted is the name of the file to be deleted.
+    With --tombstone the content is not touched, so the time does not depend on the size of the file.
+    Returns 0 if successfully and -1 on error.
+*/
+static int deleteFile(struct Star * star, const char * tarFileName,const char * fileNameTobeDeleted){
+    report(star, "\nDELETE FILE\n");
+    struct File fileTobeDeleated = findFile(star, tarFileName,fileNameTobeDeleted);
+    if (fileTobeDeleated.size==0)
+        return -1;
+    report(star, "File to be deleted: %s\tStart:%lld\tEnd: %lld\n",fileNameTobeDeleted,(long long)fileTobeDeleated.start,(long long)fileTobeDeleated.end);
+
+    if (fileTobeDeleated.chunked && deleteChunks(star, tarFileName, fileTobeDeleated) == -1) // Before its list of chunks is deleted
+        return -1;
+    if (star->options.deleteMode == STAR_DELETE_PUNCH &&
+        deleteFileContentFromBody(star, tarFileName,fileTobeDeleated) == -1) // Deletes file from body of tar file.
+        return -1;
+    if (deleteFileFromHeader(star, fileTobeDeleated) == -1 || // Deletes file from header.
+        markHeaderDirty(star) == -1 || // Re-writes header to tar when the session ends
+        loadBlankSpaces(star, openSession(star, tarFileName, 0)) == -1 ||
+        addBlankSpace(star, fileTobeDeleated.start, fileTobeDeleated.end) == -1) // Joined with the blank spaces around it
+        return -1;
+    return 0;
+}
+
+/*
+    Function to delete several files from the tar file.
+    All the files are looked for before deleting any of them, so if one is missing the tar file is not modified.
+    The header is written once, when the session ends.
+    Returns 0 if successfully and -1 on error.
+*/
+static int deleteFiles(struct Star * star, const char * tarFileName, int numFiles, const char * fileNames[]){
+    for (int i = 0; i < numFiles; i++)
+        if (findFile(star, tarFileName, fileNames[i]).size == 0)
+            return -1;
+    for (int i = 0; i < numFiles; i++)
+        if (deleteFile(star, tarFileName, fileNames[i]) == -1)
+            return -1;
+    printBlankSpaces(star);
+    return 0;
+}
+
+
+/*
+    Function to list the contents inside the tar file.
+    tarFileName is the name of the tar file.
+    Returns -1 on error.
+*/
+static int listStar(struct Star * star, const char * tarFileName) {
+    if (loadHeader(star, tarFileName) == -1) return -1;
+    report(star, "\nLIST TAR FILES\n");
+    printIndex(star); // Also with quietMode, it is the result of the operation
+    return 0;
+}
+
+/*
+    File to be placed by append.
+*/
+struct Placement {
+    off_t size;
+    int file; // Position in the list of files to be appended
+};
+
+/*
+    Function to compare two files to be placed by their size, the biggest first. Used to sort them with qsort.
+*/
+static int compareBySizeDescending(const void * first, const void * second){
+    off_t firstSize = ((const struct Placement *)first)->size;
+    off_t secondSize = ((const struct Placement *)second)->size;
+    return (firstSize < secondSize) - (firstSize > secondSize);
+}
+
+/*
+    Function to plan the positions of the files to be appended and add them to the header.
+    The biggest files take the smallest blank spaces where they fit, and the rest go after the content.
+    bySize is used to sort the files, and indexes gets the position in the header of each file.
+    Returns the end of the content after the new files, or -1 on error.
+*/
+static off_t placeFiles(struct Star * star, int numFiles, struct File * newFiles, struct Placement * bySize, int * indexes){
+    for (int i = 0; i < numFiles; i++){
+        newFiles[i].start = -1; // Not placed yet
+        bySize[i].size = newFiles[i].size;
+        bySize[i].file = i;
+    }
+
+    // Search for the smallest available space of each file
+    qsort(bySize, numFiles, sizeof(struct Placement), compareBySizeDescending);
+    for (int i = 0; i < numFiles; i++){
+        struct BlankSpace * availableSpace = findBlankSpaceForNewFile(star, bySize[i].size);
+        if (availableSpace == NULL) continue;
+        struct File * newFile = &newFiles[bySize[i].file];
+        newFile->start = availableSpace->start;
+        if (reserveSpace(star, newFile->start, newFile->start + newFile->size) == -1) // The rest of the blank space is still available
+            return -1;
+    }
+
+    // The files without space are added at the end
+    off_t endOfContent = getEndOfContent(star); // After the last file, the index and the free map
+    for (int i = 0; i < numFiles; i++) // And after the files placed in the blank space at the end, if any
+        if (newFiles[i].start != -1 && newFiles[i].start + newFiles[i].size > endOfContent)
+            endOfContent = newFiles[i].start + newFiles[i].size;
+    off_t tailStart = endOfContent;
+    for (int i = 0; i < numFiles; i++){
+        if (newFiles[i].start == -1){
+            newFiles[i].start = endOfContent;
+            endOfContent += newFiles[i].size;
+        }
+        newFiles[i].end = newFiles[i].start + newFiles[i].size;
+        if ((indexes[i] = addFileToHeaderFileList(star, newFiles[i])) == -1)
+            return -1;
+    }
+    if (reserveSpace(star, tailStart, endOfContent) == -1 || // Removes the blank space at the end, if any
+        markHeaderDirty(star) == -1) // Re-write header in tar when the session ends
+        return -1;
+    return endOfContent;
+}
+
+/*
+    Function in charge of append the content of several files in the tar file. Must look for available spaces.
+    tarFileName is the name of the tar file.
+    First the positions of all the files are planned (placeFiles).
+    The files that do not fit in any space go after the content, in the order they were given, so the packed file is grown once.
+    Then the contents are copied by numThreads threads. The header is written once, when the session ends.
+    With --compress, the files are compressed before being placed, so they take the space of their compressed size.
+    With --dedup, only their new chunks are written, and the lists of chunks are placed instead of the files.
+    Returns -1 on error.
+*/
+static int append(struct Star * star, const char * tarFileName, int numFiles, const char * fileNames[]){
+    report(star, "\nAPPEND\n");
+    if (calculateBlankSpaces(star, tarFileName) == -1) return -1; // Calculates blank spaces
+    int tarFile = openSession(star, tarFileName, 0);
+    struct File * newFiles = (struct File *)malloc(numFiles * sizeof(struct File));
+    struct Placement * bySize = (struct Placement *)malloc(numFiles * sizeof(struct Placement));
+    int * indexes = (int *)malloc(numFiles * sizeof(int));
+    off_t * spoolStarts = (off_t *)malloc(numFiles * sizeof(off_t));
+    int result = -1, spool = -2;
+    off_t endOfContent = -1;
+    if (newFiles == NULL || bySize == NULL || indexes == NULL || spoolStarts == NULL)
+        setError(star, STAR_ERROR_MEMORY, "append: Malloc for the files failed.");
+    else
+        spool = prepareFiles(star, numFiles, fileNames, newFiles, spoolStarts); // Compressed if --compress
+    if (spool != -2 && storeDictionary(star, tarFile) != -1) // If it was trained now
+        endOfContent = placeFiles(star, numFiles, newFiles, bySize, indexes);
+    if (endOfContent > star->session.size){
+        if (ftruncate(tarFile, endOfContent) == -1) // Final size, so the threads do not extend the file
+            endOfContent = setError(star, STAR_ERROR_IO, "append: Error changing the size of the tar file: %s.", strerror(errno));
+        else
+            growSession(star, endOfContent);
+    }
+
+    if (endOfContent != -1){
+        struct BodyWork work = {star, tarFile, fileNames, indexes, spool, spoolStarts, NULL};
+        result = writeFiles(star, &work, numFiles);
+    }
+    if (spool >= 0) close(spool);
+    free(spoolStarts);
+    free(newFiles);
+    free(bySize);
+    free(indexes);
+    if (result == -1) return -1;
+    printHeader(star);
+    printBlankSpaces(star);
+    return 0;
+}
+
+/*
+    Function that creates a tar file with the selected files deduplicated (--dedup).
+    The chunks are written while the files are read, so the tar file is created empty, with an index
+    with space for all the files, and then the files are appended.
+    Returns -1 on error.
+*/
+static int createDedupStar(struct Star * star, int numFiles, const char *tarFileName, const char *fileNames[]){
+    report(star, "\nCREATE TAR FILE\n");
+    off_t namesSize = 0;
+    for (int i = 0; i < numFiles; i++)
+        namesSize += strlen(fileNames[i]) + 1;
+    if (openSession(star, tarFileName,1) == -1) return -1; // Created empty
+    releaseHeader(star);
+    placeIndexAtStart(star, numFiles, namesSize);
+    star->header.loaded = 1;
+    star->freeSpace.loaded = 1; // No blank spaces
+    if (markHeaderDirty(star) == -1) return -1;
+    return append(star, tarFileName, numFiles, fileNames);
+}
+
+/*
+    Function to check the checksum of the bytes stored for a file in the tar file (checksumStoredContent).
+    Returns 0 if the checksum is the one saved in the header, 1 if the content is corrupted or can not be read.
+    The caller reports it: an extraction fails, and a verification counts it and goes on.
+*/
+static int checkStoredContent(struct Star * star, int tarFile, struct File file){
+    uint32_t checksum;
+    if (checksumStoredContent(star, tarFile, file, &checksum) == -1) return 1;
+    return checksum != file.checksum;
+}
+
+/*
+    Function to write a record of a streamed tar file at 'position', and the name that goes after it.
+    magic is STREAM_FILE_MAGIC or STREAM_END_MAGIC. Returns the position after the name, or -1 on error.
+*/
+static off_t writeStreamRecord(struct Star * star, const char * magic, const char * fileName, off_t size, mode_t mode, off_t position){
+    struct StreamRecord record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.magic, magic, sizeof(record.magic));
+    record.nameLength = fileName != NULL ? strlen(fileName) : 0;
+    record.size = size;
+    record.mode = mode;
+    if (writeFully(star, star->streamOutput, &record, sizeof(record), position) == -1 ||
+        writeFully(star, star->streamOutput, fileName, record.nameLength, position + sizeof(record)) == -1)
+        return setError(star, STAR_ERROR_IO, "createStreamStar: Error writing the tar file: %s.", strerror(errno));
+    return position + sizeof(record) + record.nameLength;
+}
+
+/*
+    Function that creates a tar file in one pass, written to the standard output (-c -).
+    The files are not measured before, each one is opened, copied and added to the header in turn.
+    Every file goes after a record with its name and size, and is followed by its checksum, so it can be extracted
+    in one pass too (extractStream). The index goes after the last file, followed by a copy of the superblock
+    that points to it. The superblock at the start is written first, without index.
+    Compression and deduplication are not available, they need to write in the tar file out of order.
+    Returns -1 on error.
+*/
+static int createStreamStar(struct Star * star, int numFiles, const char * fileNames[]){
+    report(star, "\nCREATE TAR FILE ON STANDARD OUTPUT\n");
+    releaseHeader(star);
+    star->header.loaded = 1;
+    star->header.bodyStart = SUPERBLOCK_SIZE;
+    char block[SUPERBLOCK_SIZE];
+    buildSuperblock(star, block, FEATURE_STREAMED); // Without index
+    off_t position = 0;
+    if (writeFully(star, star->streamOutput, block, sizeof(block), position) == -1)
+        return setError(star, STAR_ERROR_IO, "createStreamStar: Error writing the tar file: %s.", strerror(errno));
+    position += sizeof(block);
+
+    for (int i = 0; i < numFiles; i++){
+        int source = open(fileNames[i], O_RDONLY);
+        struct stat fileStat;
+        if (source == -1 || fstat(source, &fileStat) == -1){
+            setError(star, STAR_ERROR_IO, "createStreamStar: Error opening \"%s\": %s.", fileNames[i], strerror(errno));
+            if (source != -1) close(source);
+            return -1;
+        }
+        struct File newFile;
+        memset(&newFile, 0, sizeof(newFile));
+        newFile.fileName = (char *)fileNames[i];
+        newFile.mode = fileStat.st_mode;
+        newFile.size = newFile.originalSize = fileStat.st_size;
+        newFile.start = writeStreamRecord(star, STREAM_FILE_MAGIC, fileNames[i], newFile.size, newFile.mode, position);
+        newFile.end = newFile.start + newFile.size;
+        int failed = newFile.start == -1 ||
+                     copyContentWithChecksum(star, source, 0, star->streamOutput, newFile.start, newFile.size, &newFile.checksum) == -1 ||
+                     writeFully(star, star->streamOutput, &newFile.checksum, sizeof(newFile.checksum), newFile.end) == -1;
+        close(source);
+        if (failed)
+            return setError(star, STAR_ERROR_IO, "createStreamStar: Error writing \"%s\" on tar file.", fileNames[i]);
+        newFile.checksummed = 1;
+        position = newFile.end + sizeof(newFile.checksum);
+        report(star, "Adding \"%s\" to header's file list.\n", newFile.fileName);
+        if (addFileToHeaderListInLastPosition(star, newFile) == -1) return -1;
+    }
+    if ((position = writeStreamRecord(star, STREAM_END_MAGIC, NULL, 0, 0, position)) == -1) return -1;
+
+    // Index with the entries and then the names, in order
+    star->header.indexStart = position;
+    star->header.slotCapacity = star->header.numEntries;
+    struct IndexEntry entries[COPY_BUFFER_SIZE / sizeof(struct IndexEntry)];
+    int entriesInBlock = 0, entriesWritten = 0;
+    off_t namesSize = 0;
+    for (int i = 0; i < star->header.numEntries; i++){
+        fillIndexEntry(&entries[entriesInBlock++], &star->header.fileList[i], namesSize);
+        namesSize += strlen(star->header.fileList[i].fileName) + 1;
+        if (entriesInBlock == sizeof(entries) / sizeof(entries[0]) || i == star->header.numEntries - 1){
+            if (writeEntriesToTar(star, star->streamOutput, entries, entriesInBlock, entriesWritten) == -1) return -1;
+            entriesWritten += entriesInBlock;
+            entriesInBlock = 0;
+        }
+    }
+    struct NamesWriter * names = &star->namesWriter;
+    names->star = star;
+    names->tarFile = star->streamOutput;
+    names->namesStart = star->header.indexStart + (off_t)star->header.slotCapacity * sizeof(struct IndexEntry);
+    names->namesInBlock = 0;
+    names->namesWritten = 0;
+    for (int i = 0; i < star->header.numEntries; i++)
+        if ((star->header.fileList[i].nameOffset = addName(names, star->header.fileList[i].fileName)) == -1)
+            return -1;
+    if (flushNames(names) == -1) return -1;
+    star->header.namesSize = names->namesWritten;
+    star->header.indexCapacity = names->namesStart + star->header.namesSize - star->header.indexStart;
+    clearDirtyEntries(star);
+
+    buildSuperblock(star, block, FEATURE_STREAMED); // The same superblock, with the index
+    position = star->header.indexStart + star->header.indexCapacity;
+    if (writeFully(star, star->streamOutput, block, sizeof(block), position) == -1)
+        return setError(star, STAR_ERROR_IO, "createStreamStar: Error writing the tar file: %s.", strerror(errno));
+    star->session.size = position + sizeof(block);
+    return 0;
+}
+
+/*
+    Function to copy the content of a file of the tar file to the start of 'toFile'.
+    Compressed files are decompressed by 'threads' threads. Deduplicated files are copied chunk by chunk.
+    With --mmap, the content is written straight from the mapping of the tar file,
+    after telling the system that it is read once and in order, so it reads ahead.
+    With --verify, the checksum of a file stored as it is is calculated while it is copied, and the bytes stored
+    for a compressed or deduplicated file are checked before they are decoded.
+    Returns -1 if error.
+*/
+static int extractContent(struct Star * star, int tarFile, struct File file, int toFile, int threads){
+    int verify = star->options.verifyMode && file.checksummed;
+    if (verify && (file.compressed || file.chunked) && checkStoredContent(star, tarFile, file) != 0)
+        return setError(star, STAR_ERROR_CORRUPTED, "extractContent: The content of \"%s\" is corrupted.", file.fileName);
+    if (file.compressed)
+        return decompressContent(star, tarFile, file, toFile, threads);
+    if (file.chunked)
+        return extractChunks(star, tarFile, file, toFile);
+    uint32_t checksum = 0;
+    const char * map = star->options.readMode == STAR_READ_MMAP ? mapSession(star) : NULL;
+    if (map == NULL || file.end > star->session.mapSize){ // Not mapped, or added after mapping
+        if (copyContentWithChecksum(star, tarFile, file.start, toFile, 0, file.size, verify ? &checksum : NULL) == -1)
+            return -1;
+    }else{
+        off_t pageStart = file.start / sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE); // madvise needs whole pages
+        madvise((void *)(map + pageStart), file.end - pageStart, MADV_SEQUENTIAL);
+        madvise((void *)(map + pageStart), file.end - pageStart, MADV_WILLNEED);
+        off_t blockSize = verify ? COPY_BUFFER_SIZE : file.size; // Checked a block at a time, while it is in the cache
+        for (off_t position = 0; position < file.size; position += blockSize){
+            size_t size = file.size - position < blockSize ? (size_t)(file.size - position) : (size_t)blockSize;
+            if (verify) checksum = updateChecksum(checksum, map + file.start + position, size);
+            countCall(star, IO_MAPPED, size);
+            if (writeFully(star, toFile, map + file.start + position, size, position) == -1)
+                return setError(star, STAR_ERROR_IO, "extractContent: Error writing \"%s\": %s.", file.fileName, strerror(errno));
+        }
+    }
+    if (verify && checksum != file.checksum)
+        return setError(star, STAR_ERROR_CORRUPTED, "extractContent: The content of \"%s\" is corrupted.", file.fileName);
+    return 0;
+}
+
+/*
+    Function to copy 'length' bytes of the content of a compressed file, from 'offset', to the start of 'toFile'.
+    Only the blocks with bytes of the range are read and decompressed, and only the part of the table of blocks
+    before the last of them, which is needed to know where they start.
+    Returns -1 if error.
+*/
+static int extractCompressedRange(struct Star * star, int tarFile, struct File file, off_t offset, off_t length, int toFile){
+    off_t numBlocks = (file.originalSize + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE;
+    off_t firstBlock = offset / COMPRESSION_BLOCK_SIZE;
+    off_t lastBlock = (offset + length - 1) / COMPRESSION_BLOCK_SIZE;
+    uint32_t * table = (uint32_t *)malloc((lastBlock + 1) * sizeof(uint32_t));
+    unsigned char * stored = (unsigned char *)malloc(COMPRESSION_BLOCK_SIZE);
+    unsigned char * output = (unsigned char *)malloc(COMPRESSION_BLOCK_SIZE);
+    int result = 0;
+    if (table == NULL || stored == NULL || output == NULL)
+        result = setError(star, STAR_ERROR_MEMORY, "extractRange: Malloc for the blocks failed.");
+    else if (readFully(star, tarFile, table, (lastBlock + 1) * sizeof(uint32_t), file.start) != (ssize_t)((lastBlock + 1) * sizeof(uint32_t)))
+        result = setError(star, STAR_ERROR_IO, "extractRange: Error reading the table of blocks from tar file.");
+    off_t blockStart = file.start + numBlocks * sizeof(uint32_t);
+    for (off_t i = 0; result == 0 && i < firstBlock; i++)
+        blockStart += table[i] & ~BLOCK_STORED_RAW;
+    for (off_t i = firstBlock; result == 0 && i <= lastBlock; i++){
+        size_t storedSize = table[i] & ~BLOCK_STORED_RAW;
+        off_t position = i * COMPRESSION_BLOCK_SIZE;
+        size_t size = file.originalSize - position < COMPRESSION_BLOCK_SIZE ? file.originalSize - position : COMPRESSION_BLOCK_SIZE;
+        uLongf outputSize = size;
+        if (storedSize > COMPRESSION_BLOCK_SIZE || blockStart + (off_t)storedSize > file.end ||
+            readFully(star, tarFile, stored, storedSize, blockStart) != (ssize_t)storedSize ||
+            ((table[i] & BLOCK_STORED_RAW) ? storedSize != size :
+             decompressBlock(star, output, &outputSize, stored, storedSize) != Z_OK || outputSize != size)){
+            result = setError(star, STAR_ERROR_FORMAT, "extractRange: A block of the tar file is corrupted.");
+            break;
+        }
+        const unsigned char * block = (table[i] & BLOCK_STORED_RAW) ? stored : output;
+        off_t from = offset > position ? offset - position : 0; // Part of the block in the range
+        off_t to = offset + length < position + (off_t)size ? offset + length - position : (off_t)size;
+        if (writeFully(star, toFile, block + from, to - from, position + from - offset) == -1)
+            result = setError(star, STAR_ERROR_IO, "extractRange: Error writing the extracted range: %s.", strerror(errno));
+        blockStart += storedSize;
     }
-    close(file);
-    close(tarFile);
+    free(table);
+    free(stored);
+    free(output);
+    return result;
 }
 
 /*
-    Resets the header so it loses all its info and sets to default state.
+    Function to copy 'length' bytes of the content of a deduplicated file, from 'offset', to the start of 'toFile'.
+    Only the chunks with bytes of the range are read.
+    Returns -1 if error.
 */
-void resetHeader() {
-    for (int i = 0; i < MAX_FILES; i++) {
-        memset(header.fileList[i].fileName, 0, MAX_FILENAME_LENGTH); // Empty string
-        header.fileList[i].mode = 0; 
-        header.fileList[i].size = 0;
-        header.fileList[i].start = 0;
-        header.fileList[i].end = 0;
-        header.fileList[i].deleted = 0;
+static int extractChunkRange(struct Star * star, int tarFile, struct File file, off_t offset, off_t length, int toFile){
+    int numChunks = file.size / sizeof(uint32_t);
+    uint32_t * chunkIds = (uint32_t *)malloc(file.size);
+    if (chunkIds == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "extractRange: Malloc for the list of chunks failed.");
+    if (readFully(star, tarFile, chunkIds, file.size, file.start) != (ssize_t)file.size){
+        free(chunkIds);
+        return setError(star, STAR_ERROR_IO, "extractRange: Error reading the list of chunks from tar file.");
+    }
+    off_t position = 0; // Of the chunk in the file
+    for (int i = 0; i < numChunks && position < offset + length; i++){
+        if (chunkIds[i] >= (uint32_t)star->chunkStore.numChunks || star->chunkStore.chunks[chunkIds[i]].size == 0){
+            free(chunkIds);
+            return setError(star, STAR_ERROR_FORMAT, "extractRange: The list of chunks of \"%s\" is corrupted.", file.fileName);
+        }
+        struct ChunkEntry * chunk = &star->chunkStore.chunks[chunkIds[i]];
+        off_t chunkEnd = position + chunk->size;
+        if (chunkEnd > offset){
+            off_t from = offset > position ? offset - position : 0; // Part of the chunk in the range
+            off_t to = offset + length < chunkEnd ? offset + length - position : (off_t)chunk->size;
+            if (copyContent(star, tarFile, chunk->start + from, toFile, position + from - offset, to - from) == -1){
+                free(chunkIds);
+                return -1;
+            }
+        }
+        position = chunkEnd;
     }
+    free(chunkIds);
+    return 0;
 }
 
-
 /*
-    Function in charge of append the content of a file in the tar file. Must look for available spaces.
-    tarFileName is the name of the tar file.
-    If the new content does not fit in any space, the packed file is grown.
-*/
-void append(const char * tarFileName,const char * fileName){
-    printf("\nAPPEND\n");
-    if (sumFiles() >= MAX_FILES){
-        printf("Maximum ammount of files reached.\n");
-        exit(1);
-    }
-    calculateBlankSpaces(tarFileName); // Calculates blank spaces
-    struct stat fileStat;
-    if (lstat(fileName, &fileStat) == -1) { // Get info from the file to be added
-        perror("append: Error al obtener información del archivo.\n");
-        exit(1);
-    }
-    // Search for available space
-    struct BlankSpace * availableSpace = findBlankSpaceForNewFile(fileStat.st_size);
-    if (availableSpace == NULL){ // If there is no available space, the file is added at the end
-        writeAtTheEndOfTar(tarFileName,fileName);
+    Function to copy a range of the content of a file of the tar file to the start of 'toFile'.
+    offset is the first byte of the range in the file, and length its size, or -1 until the end of the file.
+    A range that goes beyond the end of the file is cut at the end. Only the bytes of the range are read:
+    from the tar file, or the mapping with --mmap, for files stored as they are; and only the blocks or chunks
+    with bytes of the range for compressed and deduplicated files.
+    The checksum is not checked, it needs the whole file.
+    Returns the bytes copied, or -1 if error or if offset is beyond the end of the file.
+*/
+static off_t extractRange(struct Star * star, int tarFile, struct File file, off_t offset, off_t length, int toFile){
+    if (offset < 0 || offset > file.originalSize)
+        return setError(star, STAR_ERROR_ARGUMENT, "extractRange: The offset %lld is beyond the end of \"%s\" (%lld bytes).", (long long)offset,
+                        file.fileName, (long long)file.originalSize);
+    if (length < 0 || length > file.originalSize - offset)
+        length = file.originalSize - offset;
+    if (length == 0) return 0;
+    int result;
+    if (file.compressed){
+        result = extractCompressedRange(star, tarFile, file, offset, length, toFile);
+    }else if (file.chunked){
+        result = extractChunkRange(star, tarFile, file, offset, length, toFile);
     }else{
-        // Updates header
-        strncpy(header.fileList[availableSpace->index].fileName,fileName,MAX_FILENAME_LENGTH);
-        header.fileList[availableSpace->index].deleted = 0;
-        header.fileList[availableSpace->index].start = availableSpace->start;
-        header.fileList[availableSpace->index].end = availableSpace->start + fileStat.st_size;
-        header.fileList[availableSpace->index].size = fileStat.st_size;
-        
-        int tarFile = openFile(tarFileName,0);
-        writeHeaderToTar(tarFile); // Re-write header in tar
-        close(tarFile);
-        writeFileContentToTar(tarFileName,fileName); // Write content of the file in the tar file
-        deleteBlankSpace(availableSpace->index); // Delete the blank space
+        const char * map = star->options.readMode == STAR_READ_MMAP ? mapSession(star) : NULL;
+        if (map == NULL || file.end > star->session.mapSize) // Not mapped, or added after mapping
+            result = copyContent(star, tarFile, file.start + offset, toFile, 0, length);
+        else
+            result = writeFully(star, toFile, map + file.start + offset, length, 0) == -1 ?
+                     setError(star, STAR_ERROR_IO, "extractRange: Error writing the extracted range: %s.", strerror(errno)) : 0;
     }
-    printHeader();
-    calculateBlankSpaces(tarFileName);    
+    return result == -1 ? -1 : length;
 }
 
 /*
     Function in charge of extracting the specified files from tar file.
     Reads the content of every file from the tar file and copies the content in a new file with the original name.
+    With --stdout (streamOutput) the files are written one after the other to it instead, by this thread.
     numFiles is the ammount of files to be extracted.
     tarFileName is the name of the tar file.
     fileNames is an array with all the names of the files to be extracted.
+    Returns -1 on error.
 */
-void extract(int numFiles, const char *tarFileName, const char *fileNames[]){
+static int extract(struct Star * star, int numFiles, const char *tarFileName, const char *fileNames[]){
     for (int i=0; i<numFiles; i++){
-        struct File fileToBeExtracted = findFile(tarFileName, fileNames[i]); // Reads header
-        if (fileToBeExtracted.size==0){
-            printf("extract: A file does not exist in the tar file.\n");
-            exit(11);
-        }
-        char* content = readContentFromTar(openFile(tarFileName, 0), fileToBeExtracted); // Gets the content of the file from tar
-
-        int extractedFile = openFile(fileToBeExtracted.fileName, 1); // New File
-        if (write(extractedFile, content, fileToBeExtracted.size) == -1){
-            perror("Error al escribir en el archivo de salida.");
-            free(content);
-            close(extractedFile);
-            exit(1);
-        }
-        printf("File \"%s\" extracted in execution directory.\n", fileToBeExtracted.fileName);
-        free(content); // Liberates buffer
+        struct File fileToBeExtracted = findFile(star, tarFileName, fileNames[i]); // Reads header
+        if (fileToBeExtracted.size==0)
+            return -1;
+        int tarFile = openSession(star, tarFileName, 0);
+        if (tarFile == -1) return -1;
+        if (star->streamOutput != -1){ // --stdout. Written in order by this thread
+            if (extractContent(star, tarFile, fileToBeExtracted, star->streamOutput, 1) == -1)
+                return -1;
+            report(star, "File \"%s\" extracted to standard output.\n", fileToBeExtracted.fileName);
+            continue;
+        }
+        int extractedFile = openFile(star, fileToBeExtracted.fileName, 1); // New File
+        if (extractedFile == -1) return -1;
+        int result = extractContent(star, tarFile, fileToBeExtracted, extractedFile, star->options.numThreads); // Copies the content of the file from tar
         close(extractedFile);
+        if (result == -1) return -1;
+        report(star, "File \"%s\" extracted in execution directory.\n", fileToBeExtracted.fileName);
     }
-    printHeader();
+    printHeader(star);
+    return 0;
+}
+
+/*
+    Function to extract a range of one file of the tar file (--offset and --length), to streamOutput or to a file with its name.
+    extracted gets the amount of bytes extracted.
+    Returns -1 on error.
+*/
+static int extractFileRange(struct Star * star, const char * tarFileName, const char * fileName, off_t offset, off_t length, off_t * extracted){
+    struct File fileToBeExtracted = findFile(star, tarFileName, fileName); // Reads header
+    if (fileToBeExtracted.size==0)
+        return -1;
+    int tarFile = openSession(star, tarFileName, 0);
+    if (tarFile == -1) return -1;
+    int extractedFile = star->streamOutput != -1 ? star->streamOutput : openFile(star, fileToBeExtracted.fileName, 1);
+    if (extractedFile == -1) return -1;
+    *extracted = extractRange(star, tarFile, fileToBeExtracted, offset, length, extractedFile);
+    if (extractedFile != star->streamOutput) close(extractedFile);
+    if (*extracted == -1) return -1;
+    report(star, "Extracted %lld bytes of \"%s\" from byte %lld.\n", (long long)*extracted, fileToBeExtracted.fileName,
+                 (long long)offset);
+    return 0;
+}
+
+/*
+    Information shared by the threads that extract all the files.
+*/
+struct ExtractWork {
+    struct Star * star;
+    int tarFile; // Shared by all the threads, so it is only read with positions
+    unsigned char * extracted; // 1 for the positions of the header already extracted in batches (moveSmallMembers). NULL if none
+};
+
+/*
+    Function that extracts one file of the header. Job of runInParallel used by extractAll.
+    index is the position of the file in the header. Empty positions are skipped.
+    context is an ExtractWork.
+    With --stdout there is only one thread, and the files are written one after the other to the standard output.
+    Returns -1 on error.
+*/
+static int extractFileJob(int index, void * context){
+    struct ExtractWork * work = (struct ExtractWork *)context;
+    struct Star * star = work->star;
+    struct File fileToBeExtracted = star->header.fileList[index];
+    if (fileToBeExtracted.size == 0) return 0; // No file
+    if (work->extracted != NULL && work->extracted[index]) return 0;
+    if (star->streamOutput != -1)
+        return extractContent(star, work->tarFile, fileToBeExtracted, star->streamOutput, 1);
+    int extractedFile = openFile(star, fileToBeExtracted.fileName, 1); // New File
+    if (extractedFile == -1) return -1;
+    int result = extractContent(star, work->tarFile, fileToBeExtracted, extractedFile, 1); // The threads are used for the files // Copies content
+    close(extractedFile);
+    if (result == -1) return -1;
+    report(star, "File \"%s\" extracted in execution directory.\n", fileToBeExtracted.fileName);
+    return 0;
+}
 
+/*
+    Function to extract the small files that are stored as they are (not compressed nor chunked) in batches (moveSmallMembers).
+    Sets work->extracted for the ones that were extracted, the rest is left for extractFileJob.
+    With --verify, their checksums are checked with the buffers used to copy them.
+    Returns -1 on error.
+*/
+static int extractSmallFiles(struct Star * star, struct ExtractWork * work){
+    int numEntries = star->header.numEntries;
+    struct MemberTransfer * transfers = (struct MemberTransfer *)malloc(numEntries * sizeof(struct MemberTransfer));
+    work->extracted = (unsigned char *)calloc(numEntries, 1);
+    if (transfers == NULL || work->extracted == NULL){ // All the files are extracted by the threads
+        free(transfers);
+        free(work->extracted);
+        work->extracted = NULL;
+        return 0;
+    }
+    int numTransfers = 0;
+    for (int i = 0; i < numEntries; i++){
+        struct File * file = &star->header.fileList[i];
+        if (file->size == 0 || file->size > SMALL_MEMBER_LIMIT || file->compressed || file->chunked) continue;
+        struct MemberTransfer transfer = {.fileName = file->fileName, .fromPosition = file->start, .size = file->size, .job = i};
+        transfers[numTransfers++] = transfer;
+    }
+    moveSmallMembers(star, work->tarFile, transfers, numTransfers);
+    int result = 0;
+    for (int i = 0; i < numTransfers && result != -1; i++){
+        if (transfers[i].moved != RING_MOVED) continue;
+        struct File * file = &star->header.fileList[transfers[i].job];
+        if (star->options.verifyMode && file->checksummed && transfers[i].checksum != file->checksum)
+            result = setError(star, STAR_ERROR_CORRUPTED, "extractContent: The content of \"%s\" is corrupted.", file->fileName);
+        else
+            report(star, "File \"%s\" extracted in execution directory.\n", file->fileName);
+        work->extracted[transfers[i].job] = 1;
+    }
+    free(transfers);
+    return result;
 }
 
 /*
     Functino that extracts the content of all the files in the tar file.
     Reads the content of every file from the tar file and copies the content in a new file with the original name.
+    The files are extracted by numThreads threads that share the tar file.
+    Prints the amount of bytes extracted per second when done.
     tarFileName is the name of the tar file.
+    Returns -1 on error.
 */
-void extractAll(const char *tarFileName){
-    int tarFile = openFile(tarFileName,0);
-    if (readHeaderFromTar(tarFile)!=1){
-        printf("extractAll: Error reading the header from tar.\n");
-        close(tarFile);
-        exit(10);
-    }
-    close (tarFile);
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (header.fileList[i].size!=0){ // Found a file
-            struct File fileToBeExtracted = header.fileList[i];
-            char* content = readContentFromTar(openFile(tarFileName, 0), fileToBeExtracted); // Gets content
-            int extractedFile = openFile(fileToBeExtracted.fileName, 1); // New File
-            if (write(extractedFile, content, fileToBeExtracted.size) == -1){
-                perror("Error al escribir en el archivo de salida.");
-                free(content);
-                close(extractedFile);
-                exit(1);
+static int extractAll(struct Star * star, const char *tarFileName){
+    if (loadHeader(star, tarFileName) == -1) return -1;
+    struct ExtractWork work = {star, openSession(star, tarFileName,0), NULL};
+    if (work.tarFile == -1) return -1;
+    const char * map = star->options.readMode == STAR_READ_MMAP ? mapSession(star) : NULL; // Before the threads, they share the mapping
+    double startTime = currentSeconds();
+    int result = 0;
+    if (star->streamOutput == -1 && (star->options.ioMode == STAR_IO_URING || map == NULL)) // Mapped files are read without system calls
+        result = extractSmallFiles(star, &work);
+    if (result != -1)
+        result = runInParallel(star, star->header.numEntries, star->streamOutput != -1 ? 1 : star->options.numThreads, extractFileJob, &work);
+    free(work.extracted);
+    if (result == -1) return -1;
+    double elapsed = currentSeconds() - startTime;
+
+    off_t totalBytes = getSizeOfContents(star);
+    report(star, "Extracted %lld bytes in %.3f seconds with %d thread(s): %.2f MB/s\n", (long long)totalBytes, elapsed, star->options.numThreads,
+                 elapsed > 0 ? totalBytes / elapsed / (1024 * 1024) : 0.0);
+    return 0;
+}
+
+/*
+    Function that extracts the files of a streamed tar file read from 'input' (-x - reads the standard input), in one pass.
+    Only the records before the files are used, the index at the end is not needed.
+    numFiles and fileNames are the files to be extracted. If there are none, all the files are extracted.
+    With --stdout they are written one after the other to the standard output, otherwise to files with their names.
+    With --verify, the checksum after each file is checked.
+    Returns -1 on error.
+*/
+static int extractStream(struct Star * star, int input, int numFiles, const char * fileNames[]){
+    char block[SUPERBLOCK_SIZE];
+    struct Superblock superblock;
+    if (readStream(star, input, block, sizeof(block)) != sizeof(block))
+        return setError(star, STAR_ERROR_FORMAT, "extractStream: It was not possible to read the start of the tar file.");
+    memcpy(&superblock, block, sizeof(superblock));
+    if (memcmp(superblock.magic, STAR_MAGIC, sizeof(superblock.magic)) != 0 || superblock.version != STAR_VERSION ||
+        !(superblock.features & FEATURE_STREAMED))
+        return setError(star, STAR_ERROR_FORMAT, "extractStream: The input is not a streamed tar file (created with -c -).");
+    int numFound = 0;
+    char buffer[COPY_BUFFER_SIZE];
+    while (1){
+        struct StreamRecord record;
+        if (readStream(star, input, &record, sizeof(record)) != sizeof(record) ||
+            (memcmp(record.magic, STREAM_FILE_MAGIC, 4) != 0 && memcmp(record.magic, STREAM_END_MAGIC, 4) != 0))
+            return setError(star, STAR_ERROR_FORMAT, "extractStream: The tar file is corrupted.");
+        if (memcmp(record.magic, STREAM_END_MAGIC, 4) == 0) break; // The index follows
+        char * fileName = (char *)malloc(record.nameLength + 1);
+        if (fileName == NULL)
+            return setError(star, STAR_ERROR_MEMORY, "extractStream: Malloc for the name failed.");
+        if (readStream(star, input, fileName, record.nameLength) != record.nameLength){
+            free(fileName);
+            return setError(star, STAR_ERROR_FORMAT, "extractStream: The tar file is corrupted.");
+        }
+        fileName[record.nameLength] = '\0';
+        int wanted = numFiles == 0;
+        for (int i = 0; i < numFiles && !wanted; i++)
+            wanted = strcmp(fileNames[i], fileName) == 0;
+        int extractedFile = -1; // Skipped files are read and discarded
+        int failed = 0;
+        if (wanted){
+            extractedFile = star->streamOutput != -1 ? star->streamOutput : openFile(star, fileName, 1);
+            failed = extractedFile == -1;
+            numFound++;
+        }
+        uint32_t checksum = 0, storedChecksum;
+        for (off_t position = 0; position < (off_t)record.size && !failed; ){
+            size_t blockSize = record.size - position < sizeof(buffer) ? (size_t)(record.size - position) : sizeof(buffer);
+            if (readStream(star, input, buffer, blockSize) != (ssize_t)blockSize){
+                failed = setError(star, STAR_ERROR_FORMAT, "extractStream: Unexpected end of the tar file in \"%s\".", fileName);
+                break;
+            }
+            if (star->options.verifyMode) checksum = updateChecksum(checksum, buffer, blockSize);
+            if (extractedFile != -1 && writeFully(star, extractedFile, buffer, blockSize, position) == -1){
+                failed = setError(star, STAR_ERROR_IO, "extractStream: Error writing the extracted file: %s.", strerror(errno));
+                break;
             }
-            printf("File \"%s\" extracted in execution directory.\n", fileToBeExtracted.fileName);
-            free(content); // Liberates buffer
-            close(extractedFile);
+            position += blockSize;
         }
+        if (!failed && readStream(star, input, &storedChecksum, sizeof(storedChecksum)) != sizeof(storedChecksum))
+            failed = setError(star, STAR_ERROR_FORMAT, "extractStream: Unexpected end of the tar file in \"%s\".", fileName);
+        if (!failed && wanted && star->options.verifyMode && checksum != storedChecksum)
+            failed = setError(star, STAR_ERROR_CORRUPTED, "extractStream: The content of \"%s\" is corrupted.", fileName);
+        if (extractedFile != -1 && extractedFile != star->streamOutput) close(extractedFile);
+        if (!failed && wanted)
+            report(star, "File \"%s\" extracted%s.\n", fileName, star->streamOutput != -1 ? " to standard output" : " in execution directory");
+        free(fileName);
+        if (failed) return -1;
     }
+    if (numFiles > 0 && numFound < numFiles)
+        return setError(star, STAR_ERROR_NOT_FOUND, "extractStream: A file does not exist in the tar file.");
+    return 0;
 }
 
 /*
-    Function in charge to update the contents of an archive contained in the tar file.
-    First it deletes the original content of the mentioned archive.
-    Then, it adds the new content of the same file; its position is modified according to the append function.
+    Information shared by the threads that verify the tar file.
+*/
+struct VerifyWork {
+    struct Star * star;
+    int tarFile;
+    pthread_mutex_t lock; // Protects the counters
+    int numChecked;
+    int numUnchecked; // Files without checksum, added by older versions
+    int numCorrupted; // Files and chunks
+    off_t bytesRead;
+};
+
+/*
+    Function that checks one file of the header or one chunk. Job of runInParallel used by verifyStar.
+    index is the position of the file in the header. After the files, index - header.numEntries is a chunk.
+    Files are checked with their checksum, and chunks with their hash.
+    A corrupted file or chunk is registered in the handle and counted, but the job does not fail, so the rest is checked too.
+*/
+static int verifyJob(int index, void * context){
+    struct VerifyWork * work = (struct VerifyWork *)context;
+    struct Star * star = work->star;
+    int checked = 0, corrupted = 0;
+    off_t bytes = 0;
+    if (index < star->header.numEntries){
+        struct File file = star->header.fileList[index];
+        if (file.size == 0) return 0; // No file
+        if (file.checksummed){
+            checked = 1;
+            corrupted = checkStoredContent(star, work->tarFile, file) != 0;
+            if (corrupted)
+                setError(star, STAR_ERROR_CORRUPTED, "verify: The content of \"%s\" is corrupted.", file.fileName);
+            bytes = file.size;
+        }
+    }else{
+        struct ChunkEntry * chunk = &star->chunkStore.chunks[index - star->header.numEntries];
+        if (chunk->size == 0) return 0; // Free position
+        unsigned char buffer[CHUNK_MAX_SIZE];
+        corrupted = chunk->size > CHUNK_MAX_SIZE || readFully(star, work->tarFile, buffer, chunk->size, chunk->start) != (ssize_t)chunk->size ||
+                    hashChunk(buffer, chunk->size) != chunk->hash;
+        if (corrupted)
+            setError(star, STAR_ERROR_CORRUPTED, "verify: The chunk at position %lld is corrupted.", (long long)chunk->start);
+        bytes = chunk->size;
+    }
+    pthread_mutex_lock(&work->lock);
+    if (index < star->header.numEntries){
+        if (checked) work->numChecked++;
+        else work->numUnchecked++;
+    }
+    work->numCorrupted += corrupted;
+    work->bytesRead += bytes;
+    pthread_mutex_unlock(&work->lock);
+    return 0;
+}
 
+/*
+    Function that checks every file and chunk of the tar file, without extracting anything (scrub).
+    They are read by numThreads threads that share the tar file, each one a whole file or chunk at a time.
+    Prints the amount of bytes checked per second when done.
+    Fails with STAR_ERROR_CORRUPTED if something is corrupted. The error describes the first one found.
     tarFileName is the name of the tar file.
-    fileToBeUpdatedName is the name of the file to be updated.
+    Returns -1 on error.
 */
-void update(const char *tarFileName, const char *fileToBeUpdatedName){
-    if (deleteFile(tarFileName, fileToBeUpdatedName) == 0){ // If deleted well, appends.
-        append(tarFileName, fileToBeUpdatedName);
+static int verifyStar(struct Star * star, const char * tarFileName){
+    if (loadHeader(star, tarFileName) == -1) return -1;
+    int tarFile = openSession(star, tarFileName, 0);
+    if (tarFile == -1) return -1;
+    report(star, "\nVERIFY\n");
+    if (star->options.readMode == STAR_READ_MMAP) mapSession(star); // Before the threads, they share the mapping
+    else posix_fadvise(tarFile, 0, 0, POSIX_FADV_SEQUENTIAL);
+    struct VerifyWork work = {star, tarFile, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0};
+    double startTime = currentSeconds();
+    int result = runInParallel(star, star->header.numEntries + star->chunkStore.numChunks, star->options.numThreads, verifyJob, &work);
+    pthread_mutex_destroy(&work.lock);
+    if (result == -1) return -1;
+    double elapsed = currentSeconds() - startTime;
+
+    report(star, "Verified %d file(s), %lld bytes in %.3f seconds with %d thread(s): %.2f MB/s\n", work.numChecked,
+                 (long long)work.bytesRead, elapsed, star->options.numThreads, elapsed > 0 ? work.bytesRead / elapsed / (1024 * 1024) : 0.0);
+    if (work.numUnchecked > 0)
+        report(star, "%d file(s) added by an older version have no checksum.\n", work.numUnchecked);
+    if (work.numCorrupted > 0){
+        report(star, "%d corrupted file(s) or chunk(s).\n", work.numCorrupted);
+        return setError(star, STAR_ERROR_CORRUPTED, "verify: %d corrupted file(s) or chunk(s).", work.numCorrupted); // If the jobs did not register it
     }
+    report(star, "No corrupted files.\n");
+    return 0;
 }
 
 /*
-    Returns an unique character string with all the valid content in the tar file.
+    Function in charge to update the contents of several archives contained in the tar file.
+    First it deletes the original content of all the mentioned archives.
+    Then, it adds the new content of the same files; their positions are modified according to the append function,
+    so they can use the space of the deleted ones.
+
     tarFileName is the name of the tar file.
-    * fileSum is a pointer received to be modified with the ammount of real files contained in the tar file.
+    fileNames are the names of the files to be updated.
+    Returns -1 on error.
 */
-char * getWholeBodyContentInfo(const char * tarFileName, int * filesSum){
-    char * wholeContent = (char*)malloc(getSizeOfContents()); // To store all the content
-    char * content; // Content of every file
-    for (int i=0; i < MAX_FILES; i++){
-        if (header.fileList[i].size!=0){
-            (*filesSum) += 1;
-            content = readContentFromTar(openFile(tarFileName, 0), header.fileList[i]);
-            strcat(wholeContent, content);
-        }
+static int update(struct Star * star, const char *tarFileName, int numFiles, const char *fileNames[]){
+    if (deleteFiles(star, tarFileName, numFiles, fileNames) == -1)
+        return -1;
+    return append(star, tarFileName, numFiles, fileNames); // If deleted well, appends.
+}
+
+/*
+    Returns the position in the tar file of an item of pack: a position of the header, PACK_INDEX for the index,
+    PACK_DICTIONARY for the dictionary, PACK_CHUNK_TABLE for the chunk table, or a chunk from PACK_FIRST_CHUNK down.
+*/
+static off_t getItemStart(struct Star * star, int item){
+    if (item <= PACK_FIRST_CHUNK) return star->chunkStore.chunks[PACK_FIRST_CHUNK - item].start;
+    if (item == PACK_CHUNK_TABLE) return star->chunkStore.tableStart;
+    if (item == PACK_DICTIONARY) return star->dictionary.start;
+    return item == PACK_INDEX ? star->header.indexStart : star->header.fileList[item].start;
+}
+
+/*
+    Item of pack with the position it had when pack started.
+*/
+struct PackItem {
+    off_t start;
+    int item;
+};
+
+/*
+    Function to compare two items of pack by their position in the tar file. Used to sort them with qsort.
+*/
+static int compareItemsByStart(const void * first, const void * second){
+    off_t firstStart = ((const struct PackItem *)first)->start;
+    off_t secondStart = ((const struct PackItem *)second)->start;
+    return (firstStart > secondStart) - (firstStart < secondStart);
+}
+
+/*
+    Function to write the position of a file in its entry of the index, without writing the rest of the index.
+    index is the position of the file in the header.
+    Returns -1 on error.
+*/
+static int writeFilePositionToTar(struct Star * star, int tarFile, int index){
+    uint64_t position[2] = {star->header.fileList[index].start, star->header.fileList[index].end}; // Fields start and end of the entry
+    off_t entryPosition = star->header.indexStart + (off_t)index * sizeof(struct IndexEntry) + offsetof(struct IndexEntry, start);
+    if (writeFully(star, tarFile, position, sizeof(position), entryPosition) == -1)
+        return setError(star, STAR_ERROR_IO, "pack: Error writing the index in the tar file: %s.", strerror(errno));
+    return 0;
+}
+
+/*
+    Function to move the content of a file to 'target', a lower position of the tar file.
+    The content is copied first and then its entry of the index is updated, so the index always points to a whole copy.
+    If the new place overlaps the old one, the content goes first to the end of the tar file.
+    index is the position of the file in the header.
+    Returns -1 on error.
+*/
+static int moveFileInTar(struct Star * star, int tarFile, int index, off_t target){
+    struct File * file = &star->header.fileList[index];
+    if (target + file->size > file->start){ // Copying it directly would overwrite the content the index points to
+        off_t scratch = getEndOfContent(star);
+        if (copyContent(star, tarFile, file->start, tarFile, scratch, file->size) == -1)
+            return setError(star, STAR_ERROR_IO, "pack: Error moving \"%s\" in the tar file.", file->fileName);
+        growSession(star, scratch + file->size);
+        file->start = scratch;
+        file->end = scratch + file->size;
+        if (writeFilePositionToTar(star, tarFile, index) == -1) return -1;
     }
-    free(content);
-    return wholeContent;
+    if (copyContent(star, tarFile, file->start, tarFile, target, file->size) == -1)
+        return setError(star, STAR_ERROR_IO, "pack: Error moving \"%s\" in the tar file.", file->fileName);
+    file->start = target;
+    file->end = target + file->size;
+    return writeFilePositionToTar(star, tarFile, index);
 }
 
 /*
-    Function in charge of the defragmentation command. Gets rid of the blank spaces and compresses the tar file.
+    Function to move the index to 'target', a lower position of the tar file.
+    limit is the position of the next item, the index does not go beyond it.
+    The index is written in its new place and then the superblock points to it.
+    If the new place overlaps the old one, the index is written first at the end of the tar file.
+    Returns -1 on error.
 */
-void pack(const char * tarFileName){
-    int tarFile = openFile(tarFileName,0);
-    if (readHeaderFromTar(tarFile)!=1){ // Read header from tar
-        printf("extractAll: Error reading the header of the tar file.\n");
-        close(tarFile);
-        exit(10);
-    }
-    close (tarFile);
-    calculateBlankSpaces(tarFileName); // Calculate blank spaces
-
-    printf("PACK\n");
-    int sumFiles = 0;
-    char * bodyContentBuffer = getWholeBodyContentInfo(tarFileName, &sumFiles); // Char string with all the contents sequentially
-    struct File * modifiedFiles = modifiedExistentFiles(sumFiles); // modifies the existent files' start and end position in order to be sequential
-    resetHeader(); // Re-starts the header
-    for (int j=0; j<sumFiles; j++){
-        addFileToHeaderFileList(modifiedFiles[j]); // Adds the files with the new info in the header
-    }
-    tarFile = openFile(tarFileName,0);
-    writeHeaderToTar(tarFile); // Re-write header in tar file
-    close(tarFile);
-    truncateFile(tarFileName, sizeof(header)); // Truncates the file to only leave the header
-    tarFile = openFile(tarFileName, 0);
-    if (lseek(tarFile, 0, SEEK_END) == -1) { // Moves pointer to the end of the tar file (the end of the header)
-        perror("pack: Error moving the pointer to the end of the tar file.");
-        close(tarFile);
-        exit(1);
+static int moveIndexInTar(struct Star * star, int tarFile, off_t target, off_t limit){
+    off_t namesSize = getNamesSize(star);
+    off_t oldStart = star->header.indexStart;
+    off_t scratch = getEndOfContent(star);
+    placeIndex(star, target, star->header.numEntries, namesSize);
+    if (target + star->header.indexCapacity > limit){ // Only the space until the next item, shared by entries and names
+        star->header.indexCapacity = limit - target;
+        off_t spare = star->header.indexCapacity - (off_t)star->header.numEntries * sizeof(struct IndexEntry) - namesSize;
+        star->header.slotCapacity = star->header.numEntries + spare / 2 / sizeof(struct IndexEntry);
     }
-    // Write the content stored in bodyContentBuffer at the end of the tar file
-    if (write(tarFile, bodyContentBuffer, strlen(bodyContentBuffer)) == -1) {
-        perror("pack: Error writing the content in the tar file.");
-        close(tarFile);
-        exit(1);
-    }
-    close(tarFile);
-    resetBlankSpaceList(); // Reset blank spaces list
-    printHeader();
-    printBlankSpaces();
-}
-int main(int argc, char *argv[]) {//!Modificar forma de usar las opciones
-    if (argc < 3) {
-        fprintf(stderr, "Use: %s -c|-t|-d|-r|-x|-u|-p <tarFile.tar> [files]\n", argv[0]);
-        exit(1);
-    }
-    const char * opcion = argv[1];
-    const char * tarFileName = argv[2];
-
-    // Iterate through all options
-    for (int i = 1; i < strlen(opcion); i++) {
-        char opt = opcion[i];
-        if (opt == 'c'){//* Create
-            int numFiles = argc - 3;
-            const char * fileNames[MAX_FILES];
-            for (int i = 0; i < numFiles; i++) 
-                fileNames[i] = argv[i + 3];
-            createStar(numFiles, tarFileName, fileNames);
-        } 
-        else if (opt == 't'){//* List
-            listStar(tarFileName);
-        } 
-        else if (opt == 'd'){//* Delete
-            const char * fileName;
-            fileName = argv[0 + 3]; // File to be deleted
-            deleteFile(tarFileName,fileName);
-        }
-        else if (opt == 'r'){//* Append
-            const char * fileName;
-            fileName = argv[0 + 3]; // File to be added
-            append(tarFileName,fileName);
-        }
-        else if (opt == 'x') {//* Extract
-            const char * fileNames[MAX_FILES];
-            if (argc == 3){ // Extract all
-                extractAll(tarFileName);
-            } else { // Extract some
-                int numFiles = argc - 3;
-                for (int i = 0; i < numFiles; i++) 
-                    fileNames[i] = argv[i + 3];
-                extract(numFiles, tarFileName, fileNames);
-            }
+    if (target + star->header.indexCapacity > oldStart){
+        star->header.indexStart = scratch;
+        growSession(star, scratch + star->header.indexCapacity);
+        if (writeIndexToTar(star, tarFile) == -1 || writeSuperblockToTar(star, tarFile) == -1) return -1;
+        star->header.indexStart = target;
+    }
+    if (writeIndexToTar(star, tarFile) == -1) return -1;
+    return writeSuperblockToTar(star, tarFile);
+}
+
+/*
+    Function to move the dictionary to 'target', a lower position of the tar file.
+    It is written from memory in its new place and then the superblock points to it.
+    If the new place overlaps the old one, it is written first at the end of the tar file.
+    Returns -1 on error.
+*/
+static int moveDictionaryInTar(struct Star * star, int tarFile, off_t target){
+    off_t targets[2] = {getEndOfContent(star), target};
+    for (int i = target + star->dictionary.size > star->dictionary.start ? 0 : 1; i < 2; i++){
+        if (writeFully(star, tarFile, star->dictionary.data, star->dictionary.size, targets[i]) == -1)
+            return setError(star, STAR_ERROR_IO, "pack: Error moving the dictionary in the tar file: %s.", strerror(errno));
+        growSession(star, targets[i] + star->dictionary.size);
+        star->dictionary.start = targets[i];
+        if (writeSuperblockToTar(star, tarFile) == -1) return -1;
+    }
+    return 0;
+}
+
+/*
+    Function to move a chunk to 'target', a lower position of the tar file.
+    Like the files, it is copied first and then its entry of the chunk table is updated,
+    going first to the end of the tar file if the new place overlaps the old one.
+    id is the identifier of the chunk.
+    Returns -1 on error.
+*/
+static int moveChunkInTar(struct Star * star, int tarFile, int id, off_t target){
+    struct ChunkEntry * chunk = &star->chunkStore.chunks[id];
+    off_t targets[2] = {getEndOfContent(star), target};
+    for (int i = target + chunk->size > chunk->start ? 0 : 1; i < 2; i++){
+        if (copyContent(star, tarFile, chunk->start, tarFile, targets[i], chunk->size) == -1)
+            return setError(star, STAR_ERROR_IO, "pack: Error moving a chunk in the tar file.");
+        growSession(star, targets[i] + chunk->size);
+        chunk->start = targets[i];
+        if (chunk->start + chunk->size > star->chunkStore.end) star->chunkStore.end = chunk->start + chunk->size;
+        off_t entryPosition = star->chunkStore.tableStart + (off_t)id * sizeof(struct ChunkEntry) + offsetof(struct ChunkEntry, start);
+        if (writeFully(star, tarFile, &chunk->start, sizeof(chunk->start), entryPosition) == -1)
+            return setError(star, STAR_ERROR_IO, "pack: Error writing the chunk table in the tar file: %s.", strerror(errno));
+    }
+    return 0;
+}
+
+/*
+    Function to move the chunk table to 'target', a lower position of the tar file.
+    It is written from memory in its new place and then the superblock points to it.
+    If the new place overlaps the old one, it is written first at the end of the tar file.
+    Returns -1 on error.
+*/
+static int moveChunkTableInTar(struct Star * star, int tarFile, off_t target){
+    off_t targets[2] = {getEndOfContent(star), target};
+    for (int i = target + star->chunkStore.tableCapacity > star->chunkStore.tableStart ? 0 : 1; i < 2; i++){
+        if (writeFully(star, tarFile, star->chunkStore.chunks, (size_t)star->chunkStore.numChunks * sizeof(struct ChunkEntry), targets[i]) == -1)
+            return setError(star, STAR_ERROR_IO, "pack: Error moving the chunk table in the tar file: %s.", strerror(errno));
+        growSession(star, targets[i] + star->chunkStore.tableCapacity);
+        star->chunkStore.tableStart = targets[i];
+        if (writeSuperblockToTar(star, tarFile) == -1) return -1;
+    }
+    return 0;
+}
+
+/*
+    Function to move one item of pack to 'position', if it is not there yet.
+    next is the position of the next item, the index does not go beyond it.
+    bytesMoved counts the bytes that are moved.
+    Returns the position after the item, or -1 on error.
+*/
+static off_t packItem(struct Star * star, int tarFile, int item, off_t position, off_t next, off_t * bytesMoved){
+    if (item == PACK_INDEX){
+        if (star->header.indexStart != position){
+            if (moveIndexInTar(star, tarFile, position, next) == -1) return -1;
+            *bytesMoved += star->header.indexCapacity;
         }
-        else if (opt == 'u'){//* Update
-            const char * fileName;
-            fileName = argv[0 + 3]; // File to be updated
-            update(tarFileName,fileName);
+        return star->header.indexStart + star->header.indexCapacity;
+    }else if (item == PACK_DICTIONARY){
+        if (star->dictionary.start != position){
+            if (moveDictionaryInTar(star, tarFile, position) == -1) return -1;
+            *bytesMoved += star->dictionary.size;
         }
-        else if (opt == 'p'){//* Pack
-            pack(tarFileName);
-        }else{
-            fprintf(stderr, "Uso: %s -c|-t|-d|-r|-x <archivoTar> [archivos]\n", argv[0]);
-            exit(1);
+        return star->dictionary.start + star->dictionary.size;
+    }else if (item == PACK_CHUNK_TABLE){
+        if (star->chunkStore.tableStart != position){
+            if (moveChunkTableInTar(star, tarFile, position) == -1) return -1;
+            *bytesMoved += (off_t)star->chunkStore.numChunks * sizeof(struct ChunkEntry);
+        }
+        return star->chunkStore.tableStart + star->chunkStore.tableCapacity;
+    }else if (item <= PACK_FIRST_CHUNK){
+        struct ChunkEntry * chunk = &star->chunkStore.chunks[PACK_FIRST_CHUNK - item];
+        if ((off_t)chunk->start != position){
+            if (moveChunkInTar(star, tarFile, PACK_FIRST_CHUNK - item, position) == -1) return -1;
+            *bytesMoved += chunk->size;
         }
+        return chunk->start + chunk->size;
     }
-    
-    
-    // Usa la función lseek para mover el puntero al final del archivo
-    int tarFile = openFile(tarFileName,0);
-    off_t size = lseek(tarFile, 0, SEEK_END);
+    struct File * file = &star->header.fileList[item];
+    if (file->start != position){
+        if (moveFileInTar(star, tarFile, item, position) == -1) return -1;
+        *bytesMoved += file->size;
+    }
+    return file->end;
+}
 
-    if (size == -1) {
-        perror("main: Error getting size of tar file.");
-        close(tarFile);
-        exit(1);
+/*
+    Function in charge of the defragmentation command. Gets rid of the blank spaces and compresses the tar file.
+    The files and the index are moved down one by one in the order they have in the tar file, with copies of bounded size.
+    Each move is saved in the index when it is done, so if pack is interrupted the tar file can still be read.
+    The positions of the header are not renumbered, the empty ones are reused by the next files.
+    Returns -1 on error.
+*/
+static int pack(struct Star * star, const char * tarFileName){
+    if (loadHeader(star, tarFileName) == -1) return -1; // Read header from tar
+    int tarFile = openSession(star, tarFileName, 0);
+    if (tarFile == -1) return -1;
+    report(star, "PACK\n");
+    if (markHeaderDirty(star) == -1) return -1; // Re-write header in tar file when the session ends. The index is moved
+    if (star->header.oldFormat && // The entries are written one by one while the files are moved, so they must have this format
+        flushHeader(star, tarFile) == -1)
+        return -1;
+
+    // The free map is not valid while the files are moved. Without it the blank spaces are calculated from the index
+    resetBlankSpaceList(star);
+    star->freeSpace.loaded = 1;
+    star->freeSpace.mapStart = 0;
+    star->freeSpace.mapCapacity = 0;
+    star->freeSpace.mapCount = 0;
+    star->freeSpace.mapValid = 0;
+    if (writeSuperblockToTar(star, tarFile) == -1) // The entries keep their positions until the end, only the free map is dropped
+        return -1;
+
+    // Items sorted by their position: the files, the index, the dictionary, the chunk table and the chunks
+    struct PackItem * items = (struct PackItem *)malloc((star->header.numEntries + star->chunkStore.numChunks + 3) * sizeof(struct PackItem));
+    if (items == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "pack: Malloc for the files failed.");
+    int numItems = 0;
+    for (int i = 0; i < star->header.numEntries; i++)
+        if (star->header.fileList[i].size != 0) items[numItems++].item = i;
+    items[numItems++].item = PACK_INDEX;
+    if (star->dictionary.size != 0) items[numItems++].item = PACK_DICTIONARY;
+    if (star->chunkStore.tableStart != 0) items[numItems++].item = PACK_CHUNK_TABLE;
+    for (int i = 0; i < star->chunkStore.numChunks; i++)
+        if (star->chunkStore.chunks[i].size != 0) items[numItems++].item = PACK_FIRST_CHUNK - i;
+    for (int i = 0; i < numItems; i++)
+        items[i].start = getItemStart(star, items[i].item);
+    qsort(items, numItems, sizeof(struct PackItem), compareItemsByStart);
+
+    off_t position = SUPERBLOCK_SIZE; // Where the next item goes
+    off_t bodyStart = -1;
+    off_t bytesMoved = 0;
+    double startTime = currentSeconds();
+    for (int i = 0; i < numItems && position != -1; i++){
+        if (bodyStart == -1 && items[i].item >= 0) bodyStart = position; // The first file
+        position = packItem(star, tarFile, items[i].item, position, i + 1 < numItems ? items[i + 1].start : INT64_MAX, &bytesMoved);
     }
+    free(items);
+    if (position == -1) return -1;
+    double elapsed = currentSeconds() - startTime;
+    if (star->chunkStore.tableStart != 0 && rebuildChunkIndex(star) == -1) // The end of the chunks changed
+        return -1;
 
-    printf("----------------------------------------------------\n");
-    printf("Size of tar file is of: %ld bytes.\n", (long)size);
-    printf("PROGRAM ENDS SUCCESSFULLY\n");
-    
+    star->header.bodyStart = bodyStart != -1 ? bodyStart : position;
+    if (ftruncate(tarFile, position) == -1) // Removes the blank spaces at the end
+        return setError(star, STAR_ERROR_IO, "pack: Error changing the size of the tar file: %s.", strerror(errno));
+    star->session.size = position;
+    report(star, "Moved %lld bytes in %.3f seconds: %.2f MB/s\n", (long long)bytesMoved, elapsed,
+                 elapsed > 0 ? bytesMoved / elapsed / (1024 * 1024) : 0.0);
+    printHeader(star);
+    printBlankSpaces(star);
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+    Function to fill the tables shared by every handle. Called once, by the first handle that is opened.
+*/
+static void initTables(){
+    initChecksum();
+    initGearTable();
+}
+
+/*
+    Function to forget everything the handle knows of the tar file, after an operation failed.
+    The tar file is closed without writing its header, so it keeps the header of the last time it was written,
+    and the next operation reads it again.
+*/
+static void discardSession(struct Star * star){
+    star->session.dirty = 0;
+    closeSession(star);
+    releaseHeader(star);
+    releaseChunkStore(star);
+    free(star->dictionary.data);
+    memset(&star->dictionary, 0, sizeof(star->dictionary));
+}
+
+/*
+    Function to prepare the handle for an operation: its error is cleared, and output is the file written in order
+    (streamOutput), or -1 if the files are written with their names.
+*/
+static void beginOperation(struct Star * star, int output){
+    star->errorCode = STAR_OK;
+    star->errorMessage[0] = '\0';
+    star->streamOutput = output;
+    star->operationStart = currentSeconds();
+    star->measuredSeconds = star->stats.phaseSeconds[STAR_PHASE_LOAD] + star->stats.phaseSeconds[STAR_PHASE_FLUSH];
+}
+
+/*
+    Range of the tar file pinned by a reader (--concurrent).
+*/
+struct PinnedRange {
+    off_t start;
+    off_t end;
+};
+
+/*
+    Function to compare two pinned ranges by their start. Used to sort them with qsort.
+*/
+static int compareRangesByStart(const void * first, const void * second){
+    off_t firstStart = ((const struct PinnedRange *)first)->start;
+    off_t secondStart = ((const struct PinnedRange *)second)->start;
+    return (firstStart > secondStart) - (firstStart < secondStart);
+}
+
+/*
+    Function to pin the content of files of the header, so the writer does not change it until the operation ends.
+    numFiles is 0 for all the files. The names that are not in the header are skipped, the operation reports them.
+    The chunks are pinned if any of the files is deduplicated. The ranges are sorted and the neighbours joined,
+    so the files written one after the other take one lock.
+    Nothing waits here: busy gets the first range that another command has, and the caller waits for it without locks.
+    Returns 0 if pinned, 1 if a range is busy and -1 on error.
+*/
+static int pinFiles(struct Star * star, int tarFile, int numFiles, const char * fileNames[], struct PinnedRange * busy){
+    int total = numFiles == 0 ? star->header.numEntries : numFiles;
+    struct PinnedRange * ranges = (struct PinnedRange *)malloc((total + star->chunkStore.numChunks + 1) * sizeof(struct PinnedRange));
+    if (ranges == NULL)
+        return setError(star, STAR_ERROR_MEMORY, "pinFiles: Malloc for the ranges failed.");
+    int numRanges = 0, chunked = 0;
+    for (int i = 0; i < total; i++){
+        int index = numFiles == 0 ? i : findInNameIndex(star, fileNames[i]);
+        if (index == -1 || star->header.fileList[index].size == 0) continue;
+        ranges[numRanges].start = star->header.fileList[index].start;
+        ranges[numRanges++].end = star->header.fileList[index].end;
+        if (star->header.fileList[index].chunked) chunked = 1;
+    }
+    for (int i = 0; chunked && i < star->chunkStore.numChunks; i++){
+        if (star->chunkStore.chunks[i].size == 0) continue; // Free position
+        ranges[numRanges].start = star->chunkStore.chunks[i].start;
+        ranges[numRanges++].end = star->chunkStore.chunks[i].start + star->chunkStore.chunks[i].size;
+    }
+    qsort(ranges, numRanges, sizeof(struct PinnedRange), compareRangesByStart);
+
+    int result = 0;
+    star->session.pinned = 1;
+    for (int i = 0; i < numRanges && result == 0; ){
+        struct PinnedRange range = ranges[i++];
+        while (i < numRanges && ranges[i].start <= range.end){ // Together, or overlapping
+            if (ranges[i].end > range.end) range.end = ranges[i].end;
+            i++;
+        }
+        if (range.end <= range.start) continue;
+        result = lockRange(star, tarFile, range.start, range.end - range.start, F_RDLCK, 0);
+        if (result == 1) *busy = range;
+    }
+    free(ranges);
+    return result;
+}
+
+/*
+    Function to prepare an operation that only reads the tar file (--concurrent).
+    The header is read with the lock of the header, again only if a writer wrote it since it was read (its generation changed).
+    Then the files of the operation are pinned before the lock of the header is released, so they stay like in that generation
+    while the writer appends in the blank spaces. numFiles and fileNames are like in pinFiles, and numFiles is -1 if only
+    the header is read. If a writer is changing one of the files, it waits for it and starts again.
+    The files are unpinned when the operation ends. A handle that is the writer does not pin anything.
+    Returns -1 on error.
+*/
+static int beginReading(struct Star * star, int numFiles, const char * fileNames[]){
+    if (star->options.lockMode != STAR_LOCK_RANGES || star->session.writer) return 0;
+    int tarFile = openSession(star, star->tarFileName, 0);
+    if (tarFile == -1) return -1;
+    while (1){
+        if (lockRange(star, tarFile, LOCK_HEADER_POSITION, 1, F_RDLCK, 1) == -1) return -1;
+        uint64_t generation;
+        int result = refreshSessionSize(star);
+        if (result == 0) result = readGeneration(star, tarFile, &generation);
+        if (result == 0 && star->header.loaded && generation != star->header.generation)
+            releaseHeader(star); // A writer wrote it
+        struct PinnedRange busy = {0, 0}; // Set by pinFiles when it returns 1
+        if (result == 0) result = loadHeader(star, star->tarFileName);
+        if (result == 0 && numFiles >= 0) result = pinFiles(star, tarFile, numFiles, fileNames, &busy);
+        if (result == 0) // The pins stay
+            return lockRange(star, tarFile, LOCK_HEADER_POSITION, 1, F_UNLCK, 0);
+        star->session.pinned = 0;
+        if (lockRange(star, tarFile, 0, 0, F_UNLCK, 0) == -1 || result == -1) return -1;
+        // A writer has the range: it is waited for without the lock of the header, which the writer needs to finish
+        if (lockRange(star, tarFile, busy.start, busy.end - busy.start, F_RDLCK, 1) == -1 ||
+            lockRange(star, tarFile, busy.start, busy.end - busy.start, F_UNLCK, 0) == -1)
+            return -1;
+    }
+}
+
+/*
+    Function to prepare an operation that changes the tar file (--concurrent).
+    The handle takes the lock of the writer, waiting for the writer before it, and keeps it until its session is closed.
+    If the header in memory is from an older generation, it is read again. Only the ranges that the writer changes are locked
+    later (lockContent), so the readers go on. With whole, the writer locks all the tar file, waiting for every reader:
+    for pack, which moves all the files, and for create, which empties it.
+    Returns -1 on error.
+*/
+static int beginWriting(struct Star * star, int whole){
+    if (star->options.lockMode != STAR_LOCK_RANGES) return 0;
+    int tarFile = openSession(star, star->tarFileName, 0); // Not emptied yet, the readers can be using it
+    if (tarFile == -1) return -1;
+    if (!star->session.writer){
+        if (lockRange(star, tarFile, LOCK_WRITER_POSITION, 1, F_WRLCK, 1) == -1) return -1;
+        star->session.writer = 1;
+        uint64_t generation;
+        if (refreshSessionSize(star) == -1 || readGeneration(star, tarFile, &generation) == -1) return -1;
+        if (star->header.loaded && generation != star->header.generation)
+            releaseHeader(star); // Another writer wrote it
+        star->header.generation = generation; // Create goes on from it, so the readers notice the new tar file
+    }
+    return whole ? lockRange(star, tarFile, 0, 0, F_WRLCK, 1) : 0;
+}
+
+/*
+    Function to finish an operation of the handle. result is what the operation returned.
+    Its time is added to starStats: what was not loading or flushing the header is content.
+    The files it pinned are unpinned.
+    If it failed, the changes to the tar file since the last time its header was written are discarded.
+    Returns the error code of the operation.
+*/
+static int endOperation(struct Star * star, int result){
+    double elapsed = currentSeconds() - star->operationStart;
+    double measured = star->stats.phaseSeconds[STAR_PHASE_LOAD] + star->stats.phaseSeconds[STAR_PHASE_FLUSH] - star->measuredSeconds;
+    star->stats.seconds += elapsed;
+    star->stats.phaseSeconds[STAR_PHASE_CONTENT] += elapsed > measured ? elapsed - measured : 0;
+    star->streamOutput = -1;
+    if (star->session.pinned){
+        lockRange(star, star->session.tarFile, 0, 0, F_UNLCK, 0);
+        star->session.pinned = 0;
+    }
+    if (result == -1 && star->errorCode == STAR_OK) // Every failure should have its error, just in case
+        setError(star, STAR_ERROR_IO, "The operation failed.");
+    if (star->errorCode != STAR_OK)
+        discardSession(star);
+    return star->errorCode;
+}
+
+/*
+    Function to fill the options of the command without modifiers.
+*/
+void starDefaultOptions(struct StarOptions * options){
+    memset(options, 0, sizeof(*options));
+    options->transferMode = STAR_TRANSFER_AUTO;
+    options->readMode = STAR_READ_DEFAULT;
+    options->deleteMode = STAR_DELETE_PUNCH;
+    options->numThreads = 1;
+}
+
+/*
+    Function to create a handle for the tar file tarFileName, used with 'options' (the defaults if NULL).
+    The tar file is not opened until the first operation.
+    Returns STAR_OK, STAR_ERROR_MEMORY, or STAR_ERROR_ARGUMENT if the options can not be used together.
+*/
+int starOpen(struct Star ** star, const char * tarFileName, const struct StarOptions * options){
+    *star = NULL;
+    struct StarOptions defaults;
+    if (options == NULL){
+        starDefaultOptions(&defaults);
+        options = &defaults;
+    }
+    if ((options->dedupMode && options->compressionLevel != 0) || options->compressionLevel < Z_DEFAULT_COMPRESSION ||
+        options->compressionLevel > 9 || (options->lockMode != STAR_LOCK_NONE && options->lockMode != STAR_LOCK_RANGES) ||
+        (options->ioMode != STAR_IO_SYSCALLS && options->ioMode != STAR_IO_URING))
+        return STAR_ERROR_ARGUMENT;
+    struct Star * handle = (struct Star *)calloc(1, sizeof(struct Star));
+    if (handle == NULL) return STAR_ERROR_MEMORY;
+    handle->tarFileName = strdup(tarFileName);
+    if (handle->tarFileName == NULL){
+        free(handle);
+        return STAR_ERROR_MEMORY;
+    }
+    handle->options = *options;
+    if (handle->options.numThreads <= 0) handle->options.numThreads = 1;
+    handle->session.tarFile = -1;
+    handle->streamOutput = -1;
+    handle->prioritySeed = 2463534242u;
+    pthread_mutex_init(&handle->errorLock, NULL);
+    pthread_once(&tablesOnce, initTables);
+    *star = handle;
+    return STAR_OK;
+}
+
+/*
+    Function to write the header of the tar file, if it was modified, and close it.
+    The header stays in memory for the next operations.
+*/
+int starSync(struct Star * star){
+    beginOperation(star, -1);
+    int result = closeSession(star);
+    if (star->header.namesMapped) // The names were in the mapping of the tar file, that is not valid anymore
+        releaseHeader(star);
+    return endOperation(star, result);
+}
+
+/*
+    Function to write the header of the tar file, if it was modified, and free the handle.
+    Returns the error of writing the header. The handle is freed anyway.
+*/
+int starClose(struct Star * star){
+    if (star == NULL) return STAR_OK;
+    int result = starSync(star);
+    releaseHeader(star);
+    releaseChunkStore(star);
+    free(star->dictionary.data);
+    free(star->tarFileName);
+    pthread_mutex_destroy(&star->errorLock);
+    free(star);
+    return result;
+}
+
+/*
+    Returns the description of the error of the last operation of the handle, or "" if it did not fail.
+*/
+const char * starErrorMessage(const struct Star * star){
+    if (star == NULL) return "There is no handle.";
+    return star->errorMessage;
+}
+
+/*
+    Returns the size of the tar file the last time it was written or opened by the handle.
+*/
+off_t starSize(const struct Star * star){
+    return star->session.size;
+}
+
+/*
+    Function to obtain the counters of the work done by the handle since it was opened, in 'stats'.
+    The blank spaces are the current ones, if an operation loaded them.
+*/
+void starStats(const struct Star * star, struct StarStats * stats){
+    *stats = star->stats;
+    stats->blankSpaces = -1;
+    stats->freeBytes = stats->largestBlankSpace = 0;
+    if (!star->freeSpace.loaded) return;
+    stats->blankSpaces = star->freeSpace.numBlankSpaces;
+    stats->freeBytes = star->freeSpace.totalSize;
+    for (struct BlankSpace * current = star->freeSpace.root[BY_SIZE]; current != NULL; current = current->right[BY_SIZE])
+        stats->largestBlankSpace = current->end - current->start; // The last one is the biggest
+}
+
+/*
+    Function to create the tar file with the files (-c). With dedupMode the files are deduplicated.
+*/
+int starCreate(struct Star * star, int numFiles, const char * fileNames[]){
+    beginOperation(star, -1);
+    if (beginWriting(star, 1) == -1) return endOperation(star, -1);
+    if (star->options.dedupMode)
+        return endOperation(star, createDedupStar(star, numFiles, star->tarFileName, fileNames));
+    return endOperation(star, createStar(star, numFiles, star->tarFileName, fileNames));
+}
+
+/*
+    Function to create a streamed tar file with the files, written in one pass to 'output' (-c -).
+    The name of the tar file of the handle is not used.
+*/
+int starCreateStream(struct Star * star, int numFiles, const char * fileNames[], int output){
+    beginOperation(star, output);
+    if (star->options.dedupMode || star->options.compressionLevel != 0){
+        setError(star, STAR_ERROR_ARGUMENT, "A streamed tar file can not be compressed or deduplicated.");
+        return endOperation(star, -1);
+    }
+    return endOperation(star, createStreamStar(star, numFiles, fileNames));
+}
+
+/*
+    Function to add the files to the tar file (-r).
+*/
+int starAppend(struct Star * star, int numFiles, const char * fileNames[]){
+    beginOperation(star, -1);
+    if (beginWriting(star, 0) == -1) return endOperation(star, -1);
+    return endOperation(star, append(star, star->tarFileName, numFiles, fileNames));
+}
+
+/*
+    Function to delete the files from the tar file (-d). If one of them is missing, none is deleted.
+*/
+int starDelete(struct Star * star, int numFiles, const char * fileNames[]){
+    beginOperation(star, -1);
+    if (beginWriting(star, 0) == -1) return endOperation(star, -1);
+    return endOperation(star, deleteFiles(star, star->tarFileName, numFiles, fileNames));
+}
+
+/*
+    Function to replace the files of the tar file with their current content (-u).
+*/
+int starUpdate(struct Star * star, int numFiles, const char * fileNames[]){
+    beginOperation(star, -1);
+    if (beginWriting(star, 0) == -1) return endOperation(star, -1);
+    return endOperation(star, update(star, star->tarFileName, numFiles, fileNames));
+}
+
+/*
+    Function to extract the files of the tar file (-x), or all of them if numFiles is 0.
+    output is the file they are written to, one after the other (--stdout), or -1 to write them to files with their names.
+*/
+int starExtract(struct Star * star, int numFiles, const char * fileNames[], int output){
+    beginOperation(star, output);
+    if (beginReading(star, numFiles, fileNames) == -1) return endOperation(star, -1);
+    if (numFiles == 0)
+        return endOperation(star, extractAll(star, star->tarFileName));
+    return endOperation(star, extract(star, numFiles, star->tarFileName, fileNames));
+}
+
+/*
+    Function to extract 'length' bytes of a file from 'offset' (--offset and --length), or until its end if length is -1.
+    output is like in starExtract. extracted gets the amount of bytes extracted.
+*/
+int starExtractRange(struct Star * star, const char * fileName, off_t offset, off_t length, int output, off_t * extracted){
+    beginOperation(star, output);
+    *extracted = 0;
+    if (beginReading(star, 1, &fileName) == -1) return endOperation(star, -1);
+    return endOperation(star, extractFileRange(star, star->tarFileName, fileName, offset, length, extracted));
+}
+
+/*
+    Function to extract the files of a streamed tar file read in one pass from 'input' (-x -), or all of them if numFiles is 0.
+    output is like in starExtract. The name of the tar file of the handle is not used.
+*/
+int starExtractStream(struct Star * star, int input, int numFiles, const char * fileNames[], int output){
+    beginOperation(star, output);
+    return endOperation(star, extractStream(star, input, numFiles, fileNames));
+}
+
+/*
+    Function to print the files of the tar file (-t) to the output of the options. Without output it only checks
+    that the header can be read, and the files are given by starForEachFile.
+*/
+int starList(struct Star * star){
+    beginOperation(star, -1);
+    if (beginReading(star, -1, NULL) == -1) return endOperation(star, -1);
+    return endOperation(star, listStar(star, star->tarFileName));
+}
+
+/*
+    Function to call 'action' for every file of the tar file, in the order of the header.
+    Stops at the first action that does not return 0.
+*/
+int starForEachFile(struct Star * star, int (*action)(const struct StarFile * file, void * context), void * context){
+    beginOperation(star, -1);
+    int result = beginReading(star, -1, NULL);
+    if (result == 0) result = loadHeader(star, star->tarFileName);
+    for (int i = 0; result == 0 && i < star->header.numEntries; i++){
+        const struct File * file = &star->header.fileList[i];
+        if (file->size == 0) continue; // No file
+        struct StarFile starFile;
+        starFile.fileName = file->fileName;
+        starFile.mode = file->mode;
+        starFile.size = file->compressed || file->chunked ? file->originalSize : file->size;
+        starFile.storedSize = file->size;
+        starFile.compressed = file->compressed;
+        starFile.chunked = file->chunked;
+        starFile.checksummed = file->checksummed;
+        starFile.checksum = file->checksum;
+        if (action(&starFile, context) != 0) break;
+    }
+    return endOperation(star, result);
+}
+
+/*
+    Function to check every file and chunk of the tar file (-v). Fails with STAR_ERROR_CORRUPTED if something is corrupted.
+*/
+int starVerify(struct Star * star){
+    beginOperation(star, -1);
+    if (beginReading(star, 0, NULL) == -1) return endOperation(star, -1);
+    return endOperation(star, verifyStar(star, star->tarFileName));
+}
+
+/*
+    Function to remove the blank spaces of the tar file (-p).
+*/
+int starPack(struct Star * star){
+    beginOperation(star, -1);
+    if (beginWriting(star, 1) == -1) return endOperation(star, -1);
+    return endOperation(star, pack(star, star->tarFileName));
+}
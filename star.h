@@ -0,0 +1,120 @@
+/*
+    Library of star, the file packager.
+    Every operation works on a handle (struct Star) with the state of one tar file: its header, blank spaces,
+    dictionary and chunks. Operations on different handles can run at the same time in different threads;
+    a handle must be used by one thread at a time.
+    The functions return STAR_OK or an error code, and starErrorMessage describes the last error of the handle.
+    Nothing is written to the tar file until its header is written by starSync or starClose.
+    With STAR_LOCK_RANGES, several handles and processes can use the same tar file: any amount of readers and one writer.
+    The writer keeps its lock until starSync or starClose, so they must be called as soon as its changes are done.
+
+    The library is star.c, built as libstar.a by make, and is linked with zlib and pthread. Only the functions of
+    this file are exported. The command line program is main.c, which uses the library like any other program.
+*/
+#ifndef STAR_H
+#define STAR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define STAR_OK 0
+#define STAR_ERROR_IO 1 // A file could not be opened, read or written
+#define STAR_ERROR_MEMORY 2 // Not enough memory
+#define STAR_ERROR_FORMAT 3 // The tar file is not valid, is corrupted or is of a newer version
+#define STAR_ERROR_NOT_FOUND 4 // A file is not in the tar file
+#define STAR_ERROR_CORRUPTED 5 // The content of a file does not match its checksum
+#define STAR_ERROR_ARGUMENT 6 // The operation can not be done with these arguments or options
+
+#define STAR_TRANSFER_AUTO 0 // Content is moved by the kernel when possible, otherwise through the buffer
+#define STAR_TRANSFER_BUFFERED 1 // Content is always moved through the buffer
+#define STAR_READ_DEFAULT 0 // The tar file is read with system calls
+#define STAR_READ_MMAP 1 // The tar file is mapped in memory to read the index and extract the files
+#define STAR_DELETE_PUNCH 0 // The content of a deleted file is removed with a hole, or with zeros if holes are not supported
+#define STAR_DELETE_TOMBSTONE 1 // Only the entry of a deleted file is marked, its content stays until it is overwritten
+#define STAR_LOCK_NONE 0 // The tar file is not locked: only one command can use it at a time
+#define STAR_LOCK_RANGES 1 // Readers pin the files they read and the writer locks only the ranges it changes, so they can work at the same time
+#define STAR_IO_SYSCALLS 0 // Every file is opened, copied and closed with its own system calls
+#define STAR_IO_URING 1 // Small files are moved in batches with io_uring, if the system has it. The rest, as with STAR_IO_SYSCALLS
+#define STAR_COMPRESSION_DEFAULT -1 // Default level of zlib, a balance between speed and size
+
+#define STAR_PHASE_LOAD 0 // Reading the header, the index and the blank spaces of the tar file
+#define STAR_PHASE_CONTENT 1 // The rest of the operations: placing, moving, compressing and checking the content of the files
+#define STAR_PHASE_FLUSH 2 // Writing the header, the index and the free map
+#define STAR_NUM_PHASES 3
+
+/*
+    Options of a handle. starDefaultOptions gives the ones of the command without modifiers, except output:
+    a library prints nothing unless it is asked to, and the command sets it to the standard output.
+*/
+struct StarOptions {
+    int transferMode; // How content is moved between files. --buffered
+    int readMode; // How the tar file is read. --mmap
+    int deleteMode; // How the content of deleted files is removed. --tombstone
+    int numThreads; // Amount of threads used to move content. -j
+    int compressionLevel; // zlib level used for the new files. 0: they are stored as they are. --compress
+    int dictionaryMode; // 1 if a dictionary is trained for the small files. --dictionary
+    int dedupMode; // 1 if the new files are stored as chunks shared with the rest of files. --dedup
+    int verifyMode; // 1 if the checksums of the files are checked when they are extracted, and calculated when they are added. --verify
+    int lockMode; // How the tar file is shared with other commands and handles. --concurrent
+    int ioMode; // How the small files are read and written. --uring
+    int quietMode; // 1 if the operations do not print their progress, the header and the blank spaces. --quiet
+    FILE * output; // Where the progress, the header, the blank spaces and the list of files (starList) are printed. NULL: nothing is printed
+};
+
+/*
+    Counters of the work done by a handle since it was opened, as they are given by starStats. --stats
+*/
+struct StarStats {
+    double seconds; // Wall time of all the operations
+    double phaseSeconds[STAR_NUM_PHASES]; // Part of seconds of every STAR_PHASE_*
+    uint64_t bytesRead; // Read from the files, by system calls or from the mapping of --mmap
+    uint64_t bytesWritten;
+    uint64_t readCalls; // System calls that read content: read, pread, preadv
+    uint64_t writeCalls; // System calls that write content: write, pwrite, pwritev
+    uint64_t copyCalls; // copy_file_range and splice, which read and write inside the kernel
+    uint64_t ringCalls; // io_uring_enter, each one with a batch of operations (--uring)
+    uint64_t headerFlushes; // Times the header was written to the tar file
+    int blankSpaces; // Free space of the tar file. -1 if the operations did not need to know it
+    off_t freeBytes;
+    off_t largestBlankSpace;
+};
+
+/*
+    File of the tar file, as it is given by starForEachFile.
+*/
+struct StarFile {
+    const char * fileName; // Valid until the header of the handle changes
+    mode_t mode;
+    off_t size; // Size of the file when it is extracted
+    off_t storedSize; // Bytes used in the tar file: compressed, or the list of chunks if it is deduplicated
+    int compressed;
+    int chunked;
+    int checksummed; // 1 if checksum is valid (files added by older versions have none)
+    uint32_t checksum; // CRC32C of the bytes stored
+};
+
+struct Star;
+
+void starDefaultOptions(struct StarOptions * options);
+int starOpen(struct Star ** star, const char * tarFileName, const struct StarOptions * options);
+int starSync(struct Star * star);
+int starClose(struct Star * star);
+const char * starErrorMessage(const struct Star * star);
+off_t starSize(const struct Star * star);
+void starStats(const struct Star * star, struct StarStats * stats);
+
+int starCreate(struct Star * star, int numFiles, const char * fileNames[]);
+int starCreateStream(struct Star * star, int numFiles, const char * fileNames[], int output);
+int starAppend(struct Star * star, int numFiles, const char * fileNames[]);
+int starDelete(struct Star * star, int numFiles, const char * fileNames[]);
+int starUpdate(struct Star * star, int numFiles, const char * fileNames[]);
+int starExtract(struct Star * star, int numFiles, const char * fileNames[], int output);
+int starExtractRange(struct Star * star, const char * fileName, off_t offset, off_t length, int output, off_t * extracted);
+int starExtractStream(struct Star * star, int input, int numFiles, const char * fileNames[], int output);
+int starList(struct Star * star);
+int starForEachFile(struct Star * star, int (*action)(const struct StarFile * file, void * context), void * context);
+int starVerify(struct Star * star);
+int starPack(struct Star * star);
+
+#endif
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Checks of the system calls made by star, read from the counters of --stats.
+# Usage: tests/check.sh [star]. Run by make check.
+STAR=$(cd "$(dirname "${1:-./star}")" && pwd)/$(basename "${1:-./star}")
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/star-check.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+FAILED=0
+
+# Prints the counter $2 of the "syscalls" of the JSON line of --stats (in the standard error) saved in $1
+counter(){
+    sed -n 's/.*"syscalls": {[^}]*"'"$2"'": \([0-9]*\).*/\1/p' "$1"
+}
+
+fail(){
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+# Creates $1 small files in the directory $2
+makeFiles(){
+    mkdir -p "$2"
+    i=1
+    while [ "$i" -le "$1" ]; do
+        echo "content of the file $i" > "$2/f$i"
+        i=$((i + 1))
+    done
+}
+
+# io_uring: one io_uring_enter per step of a batch of 64 members (open, move, close), whatever the number of members
+for members in 64 640; do
+    makeFiles "$members" "uring$members"
+    (cd "uring$members" && "$STAR" -c --uring --quiet --stats ../uring$members.tar f*) 2> create.out || fail "--uring -c of $members files"
+    mkdir "extract$members"
+    (cd "extract$members" && "$STAR" -x --uring --quiet --stats ../uring$members.tar) 2> extract.out || fail "--uring -x of $members files"
+    batches=$(((members + 63) / 64))
+    for out in create.out extract.out; do
+        calls=$(counter $out io_uring)
+        if [ -z "$calls" ]; then
+            fail "no counters of --stats in $out"
+        elif [ "$calls" = "0" ]; then
+            echo "SKIP: io_uring is not available"
+        elif [ "$calls" -gt $((3 * batches)) ]; then
+            fail "$members files in $batches batches made $calls io_uring_enter ($out)"
+        fi
+    done
+    diff -r "uring$members" "extract$members" > /dev/null || fail "--uring extracted other content of $members files"
+done
+
+# Files added with -c and -r are moved by the kernel (copy_file_range), and with --verify they also get checksums
+mkdir big
+for i in 1 2 3; do
+    head -c 1048576 /dev/zero | tr '\0' "$i" > "big/f$i"
+done
+for verify in "" --verify; do
+    rm -f big.tar
+    (cd big && "$STAR" -c $verify --quiet --stats ../big.tar f1 f2) 2> create.out || fail "-c $verify of big files"
+    (cd big && "$STAR" -r $verify --quiet --stats ../big.tar f3) 2> append.out || fail "-r $verify of a big file"
+    for out in create.out append.out; do
+        calls=$(counter $out copy)
+        [ -n "$calls" ] && [ "$calls" -gt 0 ] || fail "the files of $out were not moved by the kernel (${verify:-without --verify})"
+    done
+done
+printf 'X' | dd of=big.tar bs=1 seek=5000 conv=notrunc 2> /dev/null # Inside f1
+"$STAR" -v --quiet big.tar > /dev/null 2>&1
+[ $? -eq 12 ] || fail "-v did not find the corruption of a file added with --verify"
+
+[ "$FAILED" -eq 0 ] && echo "All checks passed"
+exit "$FAILED"